@@ -0,0 +1,331 @@
+#include "stdafx.h"
+#include "trie.h"
+#include "ravendb_urls.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <unordered_map>
+
+// Runs every workload against trie, std::map and std::unordered_map, and prints the time per operation,
+// the operations per second and the memory per key. Pass a word to only run the benchmarks named with it.
+// Keys and lookups come from fixed seeds, so every run measures exactly the same work.
+
+// counts the bytes the maps allocate, their memory per key is what they allocate while they are filled
+static size_t allocated_bytes = 0;
+
+void* operator new(std::size_t size) {
+	allocated_bytes += size;
+	auto p = std::malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+// results are added here, so the compiler can't drop the work that produced them
+static volatile int64_t sink = 0;
+
+struct workload {
+	const char* name;
+	std::vector<std::string> keys; // as many as a single trie holds
+	std::vector<std::string> misses; // keys that aren't stored
+	std::vector<size_t> zipf_lookups; // indexes into keys, the first keys are looked up far more than the rest
+};
+
+// keeps the keys that fit in a single trie, in the order they were given
+std::vector<std::string> fitting_keys(const std::vector<std::string>& candidates) {
+	auto t = std::make_unique<trie>();
+	std::vector<std::string> keys;
+	for (auto& key : candidates) {
+		auto result = t->write(key, (int64_t)keys.size());
+		if (result == trie::result::not_enough_space)
+			break;
+		if (result == trie::result::success)
+			keys.push_back(key);
+	}
+	return keys;
+}
+
+// Zipf with an exponent of 1, like the traffic of a route table or a cache
+std::vector<size_t> zipf_lookups(size_t keys_count, size_t lookups_count, std::mt19937_64& random) {
+	std::vector<double> cumulative(keys_count);
+	double total = 0;
+	for (size_t i = 0; i < keys_count; i++) {
+		total += 1.0 / (i + 1);
+		cumulative[i] = total;
+	}
+
+	std::uniform_real_distribution<double> uniform(0, total);
+	std::vector<size_t> lookups(lookups_count);
+	for (auto& lookup : lookups)
+		lookup = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(random)) - cumulative.begin();
+	return lookups;
+}
+
+workload make_workload(const char* name, const std::vector<std::string>& candidates, uint64_t seed) {
+	std::mt19937_64 random(seed);
+	workload result{ name, fitting_keys(candidates), {}, {} };
+
+	// the stored keys with one more byte, so lookups go as deep as the hits before they miss
+	for (auto& key : result.keys)
+		result.misses.push_back(key + '\x7F');
+	std::shuffle(result.keys.begin(), result.keys.end(), random);
+	result.zipf_lookups = zipf_lookups(result.keys.size(), 100000, random);
+	return result;
+}
+
+std::vector<workload> make_workloads() {
+	std::vector<workload> workloads;
+	workloads.push_back(make_workload("urls", ravendb_urls(), 1));
+
+	std::vector<std::string> integers;
+	for (int i = 0; i < 100000; i++)
+		integers.push_back(std::to_string(i));
+	workloads.push_back(make_workload("integers", integers, 2));
+
+	std::mt19937_64 random(3);
+	std::vector<std::string> binary;
+	for (int i = 0; i < 100000; i++) {
+		std::string key(4 + random() % 29, '\0');
+		for (auto& c : key)
+			c = (char)random();
+		binary.push_back(key);
+	}
+	workloads.push_back(make_workload("binary", binary, 4));
+	return workloads;
+}
+
+// how many keys a batched read looks up at once
+static const size_t BATCH_SIZE = 64;
+
+// The same calls on each of the containers that are measured.
+class trie_container {
+public:
+	static const char* name() { return "trie"; }
+
+	trie_container() : _trie(std::make_unique<trie>()) {
+	}
+
+	void write(const std::string& key, int64_t val) { sink += _trie->write(key, val); }
+
+	void read(const std::string& key) { sink += _trie->try_read(key).second; }
+
+	void read_many(const std::string* keys, size_t count) {
+		std::string_view views[BATCH_SIZE];
+		std::pair<bool, int64_t> results[BATCH_SIZE];
+		for (size_t i = 0; i < count; i++)
+			views[i] = keys[i];
+		_trie->try_read_many(views, count, results);
+		for (size_t i = 0; i < count; i++)
+			sink += results[i].second;
+	}
+
+	void remove(const std::string& key) { sink += _trie->remove(key); }
+
+	double bytes_per_key() const {
+		return (double)(_trie->serialized_size() - _trie->wasted_space()) / _trie->entries_count();
+	}
+
+	trie& get() { return *_trie; }
+private:
+	std::unique_ptr<trie> _trie;
+};
+
+template<typename Map>
+class std_container {
+public:
+	static const char* name() { return std::is_same<Map, std::map<std::string, int64_t>>::value ? "std::map" : "std::unordered_map"; }
+
+	std_container() : _allocated_before(allocated_bytes) {
+	}
+
+	void write(const std::string& key, int64_t val) { _map[key] = val; }
+
+	void read(const std::string& key) {
+		auto it = _map.find(key);
+		sink += it == _map.end() ? 0 : it->second;
+	}
+
+	// the maps have no batched lookup, so this is the same finds one after the other
+	void read_many(const std::string* keys, size_t count) {
+		for (size_t i = 0; i < count; i++)
+			read(keys[i]);
+	}
+
+	void remove(const std::string& key) { sink += _map.erase(key); }
+
+	double bytes_per_key() const { return (double)(allocated_bytes - _allocated_before) / _map.size(); }
+private:
+	size_t _allocated_before;
+	Map _map;
+};
+
+// Calls setup and then run until the runs add up to at least a fifth of a second, and reports the average.
+// Only run is timed, it does operations_count operations.
+template<typename Setup, typename Run>
+void measure(const std::string& name, size_t operations_count, double bytes_per_key, Setup setup, Run run) {
+	using clock = std::chrono::steady_clock;
+	clock::duration total(0);
+	size_t runs = 0;
+	while (runs < 3 || total < std::chrono::milliseconds(200)) {
+		auto state = setup();
+		auto start = clock::now();
+		run(*state);
+		total += clock::now() - start;
+		runs++;
+	}
+
+	auto ns_per_operation = std::chrono::duration<double, std::nano>(total).count() / (runs * operations_count);
+	printf("%-44s %10.1f ns/op %14.0f ops/s", name.c_str(), ns_per_operation, 1e9 / ns_per_operation);
+	if (bytes_per_key > 0)
+		printf(" %8.1f bytes/key", bytes_per_key);
+	printf("\n");
+}
+
+template<typename Container>
+std::unique_ptr<Container> filled(const workload& work) {
+	auto container = std::make_unique<Container>();
+	for (size_t i = 0; i < work.keys.size(); i++)
+		container->write(work.keys[i], (int64_t)i);
+	return container;
+}
+
+template<typename Container>
+void run_container(const workload& work, const char* filter) {
+	auto prefix = std::string(work.name) + "/" + Container::name() + "/";
+	auto matches = [filter, &prefix](const char* operation) {
+		return filter == nullptr || (prefix + operation).find(filter) != std::string::npos;
+	};
+	auto& keys = work.keys;
+	auto bytes_per_key = filled<Container>(work)->bytes_per_key();
+
+	if (matches("write")) {
+		measure(prefix + "write", keys.size(), bytes_per_key, []() { return std::make_unique<Container>(); },
+			[&keys](Container& container) {
+			for (size_t i = 0; i < keys.size(); i++)
+				container.write(keys[i], (int64_t)i);
+		});
+	}
+
+	auto full = filled<Container>(work);
+	auto same = [&full]() { return &full; };
+	if (matches("read hit")) {
+		measure(prefix + "read hit", keys.size(), 0, same, [&keys](std::unique_ptr<Container>& container) {
+			for (auto& key : keys)
+				container->read(key);
+		});
+	}
+	if (matches("read batch")) {
+		measure(prefix + "read batch", keys.size(), 0, same, [&keys](std::unique_ptr<Container>& container) {
+			for (size_t i = 0; i < keys.size(); i += BATCH_SIZE)
+				container->read_many(keys.data() + i, std::min(BATCH_SIZE, keys.size() - i));
+		});
+	}
+	if (matches("read miss")) {
+		measure(prefix + "read miss", work.misses.size(), 0, same, [&work](std::unique_ptr<Container>& container) {
+			for (auto& key : work.misses)
+				container->read(key);
+		});
+	}
+	if (matches("read zipf")) {
+		measure(prefix + "read zipf", work.zipf_lookups.size(), 0, same, [&work](std::unique_ptr<Container>& container) {
+			for (auto index : work.zipf_lookups)
+				container->read(work.keys[index]);
+		});
+	}
+	if (matches("remove")) {
+		measure(prefix + "remove", keys.size(), 0, [&work]() { return filled<Container>(work); },
+			[&keys](Container& container) {
+			for (auto& key : keys)
+				container.remove(key);
+		});
+	}
+}
+
+// a trie that has had half of its keys removed, and half as many written again, so it has holes to compact
+void run_defrag(const workload& work, const char* filter) {
+	auto name = std::string(work.name) + "/trie/defrag";
+	if (filter != nullptr && name.find(filter) == std::string::npos)
+		return;
+
+	auto churned = filled<trie_container>(work);
+	for (size_t i = 0; i < work.keys.size(); i += 2)
+		churned->remove(work.keys[i]);
+	for (size_t i = 0; i < work.keys.size(); i += 4)
+		churned->write(work.keys[i], (int64_t)i);
+
+	measure(name, 1, 0, [&churned]() { return churned->get().snapshot(); }, [](trie& t) { t.defrag(); });
+}
+
+// Lookups of random keys in random tries, out of more tries than the caches hold, one at a time and then in
+// batches to a single trie, which is where a batched lookup would have cache misses to overlap.
+void run_spread_reads(const workload& work, const char* filter) {
+	const size_t TRIES_COUNT = 512;
+	const size_t BATCHES_COUNT = 1024;
+	auto prefix = std::string(work.name) + "/trie/";
+	auto matches = [filter, &prefix](const char* operation) {
+		return filter == nullptr || (prefix + operation).find(filter) != std::string::npos;
+	};
+	if (matches("read spread") == false && matches("read spread batch") == false)
+		return;
+
+	auto full = filled<trie_container>(work);
+	std::vector<std::unique_ptr<trie>> tries;
+	for (size_t i = 0; i < TRIES_COUNT; i++)
+		tries.push_back(full->get().snapshot());
+
+	std::mt19937_64 random(7);
+	std::vector<size_t> batch_tries;
+	std::vector<std::string_view> batch_keys;
+	for (size_t i = 0; i < BATCHES_COUNT; i++) {
+		batch_tries.push_back(random() % TRIES_COUNT);
+		for (size_t j = 0; j < BATCH_SIZE; j++)
+			batch_keys.push_back(work.keys[random() % work.keys.size()]);
+	}
+
+	auto same = [&tries]() { return &tries; };
+	if (matches("read spread")) {
+		measure(prefix + "read spread", batch_keys.size(), 0, same, [&](std::vector<std::unique_ptr<trie>>& tries) {
+			for (size_t i = 0; i < BATCHES_COUNT; i++) {
+				auto& t = *tries[batch_tries[i]];
+				for (size_t j = 0; j < BATCH_SIZE; j++)
+					sink += t.try_read(batch_keys[i * BATCH_SIZE + j]).second;
+			}
+		});
+	}
+	if (matches("read spread batch")) {
+		measure(prefix + "read spread batch", batch_keys.size(), 0, same, [&](std::vector<std::unique_ptr<trie>>& tries) {
+			std::pair<bool, int64_t> results[BATCH_SIZE];
+			for (size_t i = 0; i < BATCHES_COUNT; i++) {
+				tries[batch_tries[i]]->try_read_many(batch_keys.data() + i * BATCH_SIZE, BATCH_SIZE, results);
+				for (auto& result : results)
+					sink += result.second;
+			}
+		});
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* filter = argc > 1 ? argv[1] : nullptr;
+
+	for (auto& work : make_workloads()) {
+		printf("%s: %zu keys\n", work.name, work.keys.size());
+		run_container<trie_container>(work, filter);
+		run_container<std_container<std::map<std::string, int64_t>>>(work, filter);
+		run_container<std_container<std::unordered_map<std::string, int64_t>>>(work, filter);
+		run_spread_reads(work, filter);
+		run_defrag(work, filter);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "trie.h"
+#include "trie.intrinsics.h"
+
+// A trie shared by one writer at a time and any number of reader threads, with a sequence lock: every change
+// makes the version odd while it runs, and even again once it is done. Readers take no lock, they look the
+// key up with try_read_speculative and retry if the version was odd or moved in the meantime, so readers
+// never hold up each other or the writer. Writers take a mutex among themselves.
+template<typename Trie>
+class concurrent_trie {
+public:
+	using trie_type = Trie;
+	using mapped_type = typename Trie::mapped_type;
+
+	concurrent_trie() : _version(0) {
+	}
+
+	concurrent_trie(const concurrent_trie&) = delete;
+
+	concurrent_trie& operator=(const concurrent_trie&) = delete;
+
+	std::pair<bool, mapped_type> try_read(std::string_view key) const {
+		return read([&](const Trie& trie) { return trie.try_read_speculative(key); });
+	}
+
+	int entries_count() const {
+		return read([](const Trie& trie) { return trie.entries_count(); });
+	}
+
+	// Runs action(trie) until it runs through without a change in the middle, and returns what it returned
+	// that time. The action has to cope with the trie being anything while a change is under way, like
+	// try_read_speculative does, and shouldn't keep anything it read from a run that gets thrown away.
+	template<typename Action>
+	auto read(Action action) const {
+		while (true) {
+			auto version = begin_read();
+			auto result = action(_trie);
+			if (end_read(version))
+				return result;
+		}
+	}
+
+	trie_base::result write(std::string_view key, mapped_type val) {
+		return update([&](Trie& trie) { return trie.write(key, val); });
+	}
+
+	bool remove(std::string_view key) {
+		return update([&](Trie& trie) { return trie.remove(key); });
+	}
+
+	void defrag() {
+		update([](Trie& trie) { trie.defrag(); });
+	}
+
+	// Runs action(trie) as a single change, for whatever the members above don't cover. The readers see
+	// all of it or none of it.
+	template<typename Action>
+	auto update(Action action) {
+		std::lock_guard<std::mutex> lock(_writer);
+		auto version = _version.load(std::memory_order_relaxed);
+		_version.store(version + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		struct end_write {
+			std::atomic<uint64_t>& version;
+			uint64_t next;
+			~end_write() {
+				version.store(next, std::memory_order_release);
+			}
+		} end{ _version, version + 2 };
+
+		return action(_trie);
+	}
+
+	// The trie itself, which is only safe to use while nothing changes it.
+	const Trie& unsynchronized() const {
+		return _trie;
+	}
+
+private:
+	uint64_t begin_read() const {
+		while (true) {
+			auto version = _version.load(std::memory_order_acquire);
+			if ((version & 1) == 0)
+				return version;
+			cpu_pause();
+		}
+	}
+
+	bool end_read(uint64_t version) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return _version.load(std::memory_order_relaxed) == version;
+	}
+
+	// the version and the writers' mutex get cache lines of their own, so writers don't bounce the lines readers load
+	alignas(64) std::atomic<uint64_t> _version;
+	alignas(64) std::mutex _writer;
+	Trie _trie;
+};
@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include "mapped_trie.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+mapped_file::mapped_file() : _data(nullptr), _size(0), _mode(read_only), _file(INVALID_HANDLE_VALUE), _mapping(nullptr) {
+}
+
+bool mapped_file::open(const char* path, mode mode, size_t size, bool& created) {
+	close();
+	created = false;
+
+	auto access = mode == read_only ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+	_file = CreateFileA(path, access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		mode == read_only ? OPEN_EXISTING : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+	created = mode == read_write && GetLastError() != ERROR_ALREADY_EXISTS;
+
+	// a file created here is removed again if it can't be used, so it isn't left behind empty
+	auto fail = [this, path, &created]() {
+		close();
+		if (created)
+			DeleteFileA(path);
+		created = false;
+		return false;
+	};
+
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(_file, &file_size) == FALSE || (created == false && (size_t)file_size.QuadPart != size))
+		return fail();
+
+	// mapping a new file with the full size grows it, and the new space reads as zeros
+	_mapping = CreateFileMappingA(_file, nullptr, mode == read_only ? PAGE_READONLY : PAGE_READWRITE,
+		(DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+	if (_mapping == nullptr)
+		return fail();
+
+	_data = (char*)MapViewOfFile(_mapping, mode == read_only ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, size);
+	if (_data == nullptr)
+		return fail();
+
+	_size = size;
+	_mode = mode;
+	return true;
+}
+
+bool mapped_file::flush() {
+	if (_data == nullptr || _mode == read_only)
+		return _data != nullptr;
+	return FlushViewOfFile(_data, _size) != FALSE && FlushFileBuffers(_file) != FALSE;
+}
+
+void mapped_file::close() {
+	if (_data != nullptr)
+		UnmapViewOfFile(_data);
+	if (_mapping != nullptr)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+	_data = nullptr;
+	_size = 0;
+	_mapping = nullptr;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+mapped_file::mapped_file() : _data(nullptr), _size(0), _mode(read_only), _file(-1) {
+}
+
+bool mapped_file::open(const char* path, mode mode, size_t size, bool& created) {
+	close();
+	created = false;
+
+	if (mode == read_only) {
+		_file = ::open(path, O_RDONLY);
+	}
+	else {
+		_file = ::open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+		created = _file != -1;
+		if (_file == -1 && errno == EEXIST)
+			_file = ::open(path, O_RDWR);
+	}
+	if (_file == -1)
+		return false;
+
+	// a file created here is removed again if it can't be used, so it isn't left behind empty
+	auto fail = [this, path, &created]() {
+		close();
+		if (created)
+			unlink(path);
+		created = false;
+		return false;
+	};
+
+	struct stat file_stat;
+	if (fstat(_file, &file_stat) != 0 ||
+		(created ? ftruncate(_file, (off_t)size) != 0 : (size_t)file_stat.st_size != size))
+		return fail();
+
+	// a shared mapping, so read_only processes all use the same physical pages from the page cache
+	auto data = mmap(nullptr, size, mode == read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+	if (data == MAP_FAILED)
+		return fail();
+
+	_data = (char*)data;
+	_size = size;
+	_mode = mode;
+	return true;
+}
+
+bool mapped_file::flush() {
+	if (_data == nullptr || _mode == read_only)
+		return _data != nullptr;
+	return msync(_data, _size, MS_SYNC) == 0;
+}
+
+void mapped_file::close() {
+	if (_data != nullptr)
+		munmap(_data, _size);
+	if (_file != -1)
+		::close(_file);
+	_data = nullptr;
+	_size = 0;
+	_file = -1;
+}
+
+#endif
+
+mapped_file::~mapped_file() {
+	close();
+}
+
+char* mapped_file::data() const {
+	return _data;
+}
+
+size_t mapped_file::size() const {
+	return _size;
+}
+
+bool mapped_file::is_read_only() const {
+	return _mode == read_only;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "trie.h"
+
+// A file mapped into memory, shared with every other process that maps it.
+class mapped_file {
+public:
+	enum mode {
+		read_only,
+		read_write
+	};
+
+	mapped_file();
+
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Maps a file of exactly size bytes. In read_write mode a file that doesn't exist is created, filled
+	// with zeros, and created is set. Returns false if the file can't be opened, mapped, or has another size,
+	// and removes the file again if it was created for this.
+	bool open(const char* path, mode mode, size_t size, bool& created);
+
+	// writes the changes made through the mapping back to the file, and waits for them to get there
+	bool flush();
+
+	void close();
+
+	char* data() const;
+
+	size_t size() const;
+
+	bool is_read_only() const;
+
+private:
+	char* _data;
+	size_t _size;
+	mode _mode;
+#if defined(_WIN32)
+	void* _file;
+	void* _mapping;
+#else
+	int _file;
+#endif
+};
+
+// A trie that lives in a file, and is used in place from the mapped memory: the buffer of a trie has no
+// pointers in it, only offsets, so there is nothing to load or fix up when it is opened. Tries opened
+// read_only are shared by all the processes that map the file, and can only be read, through reader().
+template<typename Trie>
+class basic_mapped_trie {
+	static_assert(sizeof(Trie) == Trie::BUFFER_SIZE, "the file holds the buffer of the trie and nothing else");
+public:
+	using trie_type = Trie;
+
+	basic_mapped_trie() = default;
+
+	~basic_mapped_trie() {
+		close();
+	}
+
+	// An existing file must hold a trie that passes validate, and opened read_only, its checksum must match
+	// too, so a file that was damaged on disk, or changed after its last flush or close, doesn't open.
+	// A writer that stopped between a change and the next flush or close leaves a sound trie with a stale
+	// checksum behind, so opened read_write, a trie that passes validate gets its checksum set again, and
+	// can then be opened read_only as well. report says why validate failed.
+	bool open(const char* path, mapped_file::mode mode, trie_base::validation_report* report = nullptr) {
+		close();
+		bool created = false;
+		if (_file.open(path, mode, sizeof(Trie), created) == false)
+			return false;
+		if (created) {
+			new (_file.data()) Trie(); // only sets up the header, the rest of the buffer is unused
+			writer()->update_checksum();
+			return true;
+		}
+
+		trie_base::validation_report ignored;
+		if ((mode == mapped_file::read_only && reader().verify_checksum() == false) ||
+			reader().validate(report != nullptr ? *report : ignored) == false) {
+			_file.close();
+			return false;
+		}
+		if (mode == mapped_file::read_write && reader().verify_checksum() == false)
+			writer()->update_checksum();
+		return true;
+	}
+
+	// sets the checksum, and then writes the trie back to the file
+	bool flush() {
+		if (is_open() && is_read_only() == false)
+			writer()->update_checksum();
+		return _file.flush();
+	}
+
+	// sets the checksum too, but leaves it to the system to write the trie back
+	void close() {
+		if (is_open() && is_read_only() == false)
+			writer()->update_checksum();
+		_file.close();
+	}
+
+	bool is_open() const {
+		return _file.data() != nullptr;
+	}
+
+	bool is_read_only() const {
+		return _file.is_read_only();
+	}
+
+	// the trie in the file, or nullptr if it was opened read_only, since writing to it would fault
+	Trie* writer() {
+		return _file.is_read_only() ? nullptr : (Trie*)_file.data();
+	}
+
+	const Trie& reader() const {
+		return *(const Trie*)_file.data();
+	}
+
+private:
+	mapped_file _file;
+};
+
+using mapped_trie = basic_mapped_trie<trie>;
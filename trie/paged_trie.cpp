@@ -0,0 +1,242 @@
+#include "stdafx.h"
+#include "paged_trie.h"
+
+paged_trie::paged_trie() : _root(0), _height(0), _entries_count(0) {
+	_pages.push_back(std::make_unique<page>());
+}
+
+size_t paged_trie::entries_count() {
+	return _entries_count;
+}
+
+size_t paged_trie::pages_count() {
+	return _pages.size();
+}
+
+int paged_trie::height() {
+	return _height;
+}
+
+// The child whose range has the key, which is the one stored under the first separator after the key.
+int64_t paged_trie::route(page& interior, std::string_view key) {
+	auto it = interior.lower_bound(key);
+	if (it != interior.end() && (*it).first == key)
+		++it; // the key is where the range of the next child starts
+	return it == interior.end() ? interior.try_read("").second : (*it).second;
+}
+
+// Returns the leaf page that the key belongs to, path gets the pages on the way to it, root first.
+int64_t paged_trie::find_leaf(std::string_view key, int64_t* path) {
+	auto current = _root;
+	for (int level = 0; level < _height; level++) {
+		path[level] = current;
+		current = route(*_pages[current], key);
+	}
+	path[_height] = current;
+	return current;
+}
+
+std::vector<std::pair<std::string, int64_t>> read_all(paged_trie::page& page) {
+	std::vector<std::pair<std::string, int64_t>> entries;
+	entries.reserve(page.entries_count());
+	for (auto entry : page)
+		entries.emplace_back(std::string(entry.first), entry.second);
+	return entries;
+}
+
+trie::result load(paged_trie::page& page, const std::pair<std::string, int64_t>* first, const std::pair<std::string, int64_t>* last) {
+	std::vector<std::pair<std::string_view, int64_t>> items;
+	items.reserve(last - first);
+	for (auto it = first; it != last; it++)
+		items.emplace_back(it->first, it->second);
+	return page.bulk_load(items.data(), items.size());
+}
+
+// the shortest key that sorts after the last key of the left page, and not after the first key of the right one
+std::string shortest_separator(const std::string& left, const std::string& right) {
+	size_t shared = 0;
+	while (shared < left.length() && left[shared] == right[shared])
+		shared++;
+	return right.substr(0, shared + 1);
+}
+
+int64_t paged_trie::stage_new_page(staged_pages& staged) {
+	auto number = (int64_t)_pages.size();
+	for (auto& staged_page : staged.pages) {
+		if (staged_page.first >= number)
+			number = staged_page.first + 1;
+	}
+	staged.pages.emplace_back(number, std::make_unique<page>());
+	return number;
+}
+
+// Writes the entries, which are sorted, into a new version of the page at path[level], splitting it in two if
+// they don't fit, and then adding the new page to a new version of its parent in the same way.
+trie::result paged_trie::store(int64_t* path, int level, std::vector<std::pair<std::string, int64_t>>& entries, staged_pages& staged) {
+	staged.pages.emplace_back(path[level], std::make_unique<page>());
+	auto& current = *staged.pages.back().second;
+	auto data = entries.data();
+	if (load(current, data, data + entries.size()) == trie::result::success)
+		return trie::result::success;
+
+	if (level == 0 && _height + 1 >= MAX_HEIGHT)
+		return trie::result::not_enough_space;
+
+	std::string separator;
+	std::vector<std::pair<std::string, int64_t>> left, right;
+	if (level == _height) {
+		auto middle = entries.size() / 2;
+		separator = shortest_separator(entries[middle - 1].first, entries[middle].first);
+		left.assign(entries.begin(), entries.begin() + middle);
+		right.assign(entries.begin() + middle, entries.end());
+	}
+	else {
+		// entries[0] is the empty key of the last child, the separator moves up to the parent, and
+		// the child stored under it becomes the last child of the left page
+		auto middle = (entries.size() + 1) / 2;
+		separator = entries[middle].first;
+		left.emplace_back(std::string(), entries[middle].second);
+		left.insert(left.end(), entries.begin() + 1, entries.begin() + middle);
+		right.emplace_back(std::string(), entries[0].second);
+		right.insert(right.end(), entries.begin() + middle + 1, entries.end());
+	}
+
+	auto right_page = stage_new_page(staged);
+	if (load(current, left.data(), left.data() + left.size()) != trie::result::success ||
+		load(*staged.pages.back().second, right.data(), right.data() + right.size()) != trie::result::success)
+		return trie::result::not_enough_space;
+
+	if (level == 0) {
+		auto root = stage_new_page(staged);
+		std::vector<std::pair<std::string, int64_t>> children{ { std::string(), right_page }, { separator, path[0] } };
+		auto result = load(*staged.pages.back().second, children.data(), children.data() + children.size());
+		staged.new_root = root;
+		return result;
+	}
+
+	// the parent now has the right page where it had this one, and this one under the separator
+	auto parent = read_all(*_pages[path[level - 1]]);
+	for (auto& entry : parent) {
+		if (entry.second == path[level])
+			entry.second = right_page;
+	}
+	auto position = std::lower_bound(parent.begin(), parent.end(), separator,
+		[](const std::pair<std::string, int64_t>& entry, const std::string& key) { return entry.first < key; });
+	parent.emplace(position, separator, path[level]);
+	return store(path, level - 1, parent, staged);
+}
+
+void paged_trie::commit(staged_pages& staged) {
+	for (auto& staged_page : staged.pages) {
+		if (staged_page.first < (int64_t)_pages.size())
+			_pages[staged_page.first] = std::move(staged_page.second);
+		else
+			_pages.push_back(std::move(staged_page.second));
+	}
+	if (staged.new_root >= 0) {
+		_root = staged.new_root;
+		_height++;
+	}
+}
+
+trie::result paged_trie::write(std::string_view key, int64_t val) {
+	if (key.length() > UINT8_MAX)
+		return trie::result::key_too_large;
+
+	int64_t path[MAX_HEIGHT + 1];
+	auto& leaf = *_pages[find_leaf(key, path)];
+	auto before = leaf.entries_count();
+	auto result = leaf.write(key, val);
+	if (result == trie::result::success) {
+		_entries_count += leaf.entries_count() - before;
+		return result;
+	}
+	if (result != trie::result::not_enough_space && result != trie::result::defrag_required &&
+		result != trie::result::max_number_of_items_stored)
+		return result;
+
+	// the leaf is full, since a write needs room for a new entry even when it ends up overwriting one
+	auto entries = read_all(leaf);
+	auto position = std::lower_bound(entries.begin(), entries.end(), key,
+		[](const std::pair<std::string, int64_t>& entry, std::string_view key) { return entry.first < key; });
+	bool overwrite = position != entries.end() && position->first == key;
+	if (overwrite)
+		position->second = val;
+	else
+		entries.emplace(position, std::string(key), val);
+
+	staged_pages staged;
+	result = store(path, _height, entries, staged);
+	if (result != trie::result::success)
+		return result;
+	commit(staged);
+	if (overwrite == false)
+		_entries_count++;
+	return result;
+}
+
+std::pair<bool, int64_t> paged_trie::try_read(std::string_view key) {
+	int64_t path[MAX_HEIGHT + 1];
+	return _pages[find_leaf(key, path)]->try_read(key);
+}
+
+bool paged_trie::remove(std::string_view key) {
+	int64_t path[MAX_HEIGHT + 1];
+	if (_pages[find_leaf(key, path)]->remove(key) == false)
+		return false;
+	_entries_count--;
+	return true;
+}
+
+void paged_trie::validate() {
+	struct range {
+		int64_t page;
+		int level;
+		std::string low;
+		std::string high; // empty for the last child, which has no end
+	};
+
+	size_t entries = 0;
+	std::stack<range> pages;
+	pages.push(range{ _root, 0, std::string(), std::string() });
+	while (pages.size() > 0) {
+		auto current = pages.top();
+		pages.pop();
+
+		auto& page = *_pages[current.page];
+		page.validate();
+
+		if (current.level == _height) {
+			for (auto entry : page) {
+				if (entry.first < current.low || (current.high.empty() == false && entry.first >= current.high)) {
+					std::cerr << "leaf has a key outside of its range" << std::endl;
+					return;
+				}
+			}
+			entries += page.entries_count();
+			continue;
+		}
+
+		auto last = page.try_read("");
+		if (last.first == false) {
+			std::cerr << "interior page has no last child" << std::endl;
+			return;
+		}
+
+		auto low = current.low;
+		for (auto entry : page) {
+			if (entry.first.empty())
+				continue;
+			if (entry.first <= low || (current.high.empty() == false && entry.first >= current.high)) {
+				std::cerr << "separator outside of the range of its page" << std::endl;
+				return;
+			}
+			pages.push(range{ entry.second, current.level + 1, low, std::string(entry.first) });
+			low = std::string(entry.first);
+		}
+		pages.push(range{ last.second, current.level + 1, low, current.high });
+	}
+
+	if (entries != _entries_count)
+		std::cerr << "leaves don't add up to the number of entries" << std::endl;
+}
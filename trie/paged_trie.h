@@ -0,0 +1,58 @@
+#pragma once
+
+#include "trie.h"
+
+// A B+tree whose pages are tries, for more entries than a single page can hold. Leaf pages hold the entries,
+// and split by key range once they are full. Interior pages route the lookups: they map the separator that
+// ends the range of each child page, except the last one, to the number of that page. The last child has
+// no end to its range, and is stored under the empty key, which a lookup never lands on.
+// Pages are not merged when they empty out.
+class paged_trie {
+public:
+	using page = trie;
+
+	paged_trie();
+
+	size_t entries_count();
+
+	size_t pages_count();
+
+	// the number of interior levels above the leaves
+	int height();
+
+	trie::result write(std::string_view key, int64_t val);
+
+	std::pair<bool, int64_t> try_read(std::string_view key);
+
+	bool remove(std::string_view key);
+
+	void validate();
+
+private:
+
+	// far more than the number of levels needed to fill the address space
+	static const int MAX_HEIGHT = 32;
+
+	int64_t route(page& interior, std::string_view key);
+
+	int64_t find_leaf(std::string_view key, int64_t* path);
+
+	// The pages a store writes, by their numbers, which only take the place of the pages in the tree once all of
+	// them have been written, so a store that fails leaves the tree as it was. New pages get the numbers after
+	// the last page, in the order they are staged.
+	struct staged_pages {
+		std::vector<std::pair<int64_t, std::unique_ptr<page>>> pages;
+		int64_t new_root = -1;
+	};
+
+	int64_t stage_new_page(staged_pages& staged);
+
+	trie::result store(int64_t* path, int level, std::vector<std::pair<std::string, int64_t>>& entries, staged_pages& staged);
+
+	void commit(staged_pages& staged);
+
+	std::vector<std::unique_ptr<page>> _pages;
+	int64_t _root;
+	int _height;
+	size_t _entries_count;
+};
@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "sharded_trie.h"
+
+sharded_trie::shard::shard(int first_bit) : first_bit(first_bit), splits_count(0) {
+	for (auto& split : splits)
+		split.store(nullptr, std::memory_order_relaxed);
+}
+
+sharded_trie::shard::~shard() {
+	for (int i = 0; i < splits_count; i++)
+		delete splits[i].load();
+}
+
+sharded_trie::sharded_trie(int shards_count) : _root_bits(0) {
+	while ((1 << _root_bits) < shards_count)
+		_root_bits++;
+	for (int i = 0; i < (1 << _root_bits); i++)
+		_roots.push_back(std::make_unique<shard>(_root_bits));
+}
+
+size_t sharded_trie::hash_of(std::string_view key) {
+	return std::hash<std::string_view>()(key);
+}
+
+sharded_trie::shard& sharded_trie::root_for(size_t hash) const {
+	return *_roots[hash & (((size_t)1 << _root_bits) - 1)];
+}
+
+// The split the hash goes on to, which is the first one whose bit it has, or nullptr if it stays here.
+// A split is stored before the count that makes it visible, so it can be followed as soon as it is seen.
+sharded_trie::shard* sharded_trie::route(const shard& current, size_t hash) {
+	auto count = current.splits_count.load(std::memory_order_acquire);
+	for (int i = 0; i < count; i++) {
+		if ((hash >> (current.first_bit + i)) & 1)
+			return current.splits[i].load(std::memory_order_relaxed);
+	}
+	return nullptr;
+}
+
+// Moves the entries that have the next bit of the hash set from the full page to a new shard. This runs
+// as a change of the full page, so the readers in the middle of it start over and see the split.
+bool sharded_trie::split(shard& current, page& full) {
+	auto count = current.splits_count.load(std::memory_order_relaxed);
+	auto bit = current.first_bit + count;
+	if (bit >= HASH_BITS)
+		return false;
+
+	std::vector<std::pair<std::string, int64_t>> moved_entries;
+	for (auto entry : full) {
+		if ((hash_of(entry.first) >> bit) & 1)
+			moved_entries.emplace_back(std::string(entry.first), entry.second);
+	}
+	std::vector<std::pair<std::string_view, int64_t>> moved;
+	for (auto& entry : moved_entries)
+		moved.emplace_back(entry.first, entry.second);
+
+	auto next = std::make_unique<shard>(bit + 1);
+	auto result = next->entries.update([&](page& entries) { return entries.bulk_load(moved.data(), moved.size()); });
+	if (result != trie::result::success)
+		return false;
+
+	current.splits[count].store(next.release(), std::memory_order_relaxed);
+	current.splits_count.store(count + 1, std::memory_order_release);
+
+	// removing never needs room, the space they leave is reclaimed by the next defrag
+	for (auto& entry : moved_entries)
+		full.remove(entry.first);
+	return true;
+}
+
+trie::result sharded_trie::write(std::string_view key, int64_t val) {
+	auto hash = hash_of(key);
+	auto current = &root_for(hash);
+	while (true) {
+		if (auto next = route(*current, hash)) {
+			current = next;
+			continue;
+		}
+
+		// the shard may split before the writer lock is taken, so the route is checked again under it
+		bool retry = false;
+		auto result = current->entries.update([&](page& entries) {
+			if (route(*current, hash) != nullptr) {
+				retry = true;
+				return trie::result::success;
+			}
+			// a page that is out of room in any way moves half of its entries to a new shard
+			auto result = entries.write(key, val);
+			auto full = result == trie::result::not_enough_space || result == trie::result::defrag_required ||
+				result == trie::result::max_number_of_items_stored;
+			retry = full && split(*current, entries);
+			return result;
+		});
+		if (retry == false)
+			return result;
+	}
+}
+
+std::pair<bool, int64_t> sharded_trie::try_read(std::string_view key) const {
+	auto hash = hash_of(key);
+	const shard* current = &root_for(hash);
+	while (true) {
+		const shard* next = nullptr;
+		auto result = current->entries.read([&](const page& entries) {
+			next = route(*current, hash);
+			return next != nullptr ? std::make_pair(false, (int64_t)0) : entries.try_read_speculative(key);
+		});
+		if (next == nullptr)
+			return result;
+		current = next;
+	}
+}
+
+bool sharded_trie::remove(std::string_view key) {
+	auto hash = hash_of(key);
+	auto current = &root_for(hash);
+	while (true) {
+		if (auto next = route(*current, hash)) {
+			current = next;
+			continue;
+		}
+
+		bool retry = false;
+		auto removed = current->entries.update([&](page& entries) {
+			retry = route(*current, hash) != nullptr;
+			return retry == false && entries.remove(key);
+		});
+		if (retry == false)
+			return removed;
+	}
+}
+
+template<typename Action>
+void sharded_trie::for_each_shard(Action action) const {
+	std::stack<const shard*> shards;
+	for (auto& root : _roots)
+		shards.push(root.get());
+	while (shards.size() > 0) {
+		auto current = shards.top();
+		shards.pop();
+		action(*current);
+		for (int i = 0; i < current->splits_count; i++)
+			shards.push(current->splits[i]);
+	}
+}
+
+size_t sharded_trie::entries_count() const {
+	size_t count = 0;
+	for_each_shard([&count](const shard& current) { count += current.entries.entries_count(); });
+	return count;
+}
+
+size_t sharded_trie::shards_count() const {
+	size_t count = 0;
+	for_each_shard([&count](const shard&) { count++; });
+	return count;
+}
+
+void sharded_trie::validate() const {
+	bool error = false;
+	for_each_shard([&](const shard& current) {
+		auto& entries = current.entries.unsynchronized();
+		entries.validate();
+		for (auto entry : entries) {
+			auto hash = hash_of(entry.first);
+			const shard* owner = &root_for(hash);
+			while (auto next = route(*owner, hash))
+				owner = next;
+			if (owner != &current && error == false) {
+				std::cerr << "shard has a key that belongs to another one" << std::endl;
+				error = true;
+			}
+		}
+	});
+}
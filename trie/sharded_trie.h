@@ -0,0 +1,68 @@
+#pragma once
+
+#include "trie.h"
+#include "concurrent_trie.h"
+
+// A map of many tries that any number of threads can read and write at once. Keys are hashed to one of the
+// root shards, each a trie page behind its own sequence lock, see concurrent_trie, so writers only contend
+// on the same shard and readers never wait. A shard that runs out of room splits on the next bit of the
+// hash: the keys that have it set move to a new shard, which is recorded in the old one. Splits are never
+// undone, so a reader that sees one can follow it without checking anything else.
+class sharded_trie {
+public:
+	using page = trie;
+
+	// shards_count is rounded up to a power of two
+	explicit sharded_trie(int shards_count);
+
+	sharded_trie(const sharded_trie&) = delete;
+
+	sharded_trie& operator=(const sharded_trie&) = delete;
+
+	// counts every shard in turn, so it is only exact while nothing writes
+	size_t entries_count() const;
+
+	// the root shards and the ones split from them
+	size_t shards_count() const;
+
+	trie::result write(std::string_view key, int64_t val);
+
+	std::pair<bool, int64_t> try_read(std::string_view key) const;
+
+	bool remove(std::string_view key);
+
+	// only while nothing writes
+	void validate() const;
+
+private:
+	static const int HASH_BITS = (int)sizeof(size_t) * 8;
+
+	struct alignas(64) shard {
+		explicit shard(int first_bit);
+
+		~shard();
+
+		concurrent_trie<page> entries;
+
+		// the hash bit of the first split, each split after it takes the next bit
+		int first_bit;
+
+		// the shards split off this one, in order, they are only added to while holding the writer lock of entries
+		std::atomic<int> splits_count;
+		std::atomic<shard*> splits[HASH_BITS];
+	};
+
+	static size_t hash_of(std::string_view key);
+
+	static shard* route(const shard& current, size_t hash);
+
+	static bool split(shard& current, page& full);
+
+	shard& root_for(size_t hash) const;
+
+	template<typename Action>
+	void for_each_shard(Action action) const;
+
+	std::vector<std::unique_ptr<shard>> _roots;
+	int _root_bits;
+};
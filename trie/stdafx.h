@@ -8,9 +8,21 @@
 #include "targetver.h"
 
 #include <stdio.h>
+#if defined(_WIN32)
 #include <tchar.h>
+#endif
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <iostream>
 #include <iterator>
@@ -1,6 +1,19 @@
 #include "stdafx.h"
 #include "catch.h"
 #include "trie.h"
+#include "paged_trie.h"
+#include "sharded_trie.h"
+#include "mapped_trie.h"
+#include "concurrent_trie.h"
+#include "trie_handle.h"
+#include "ravendb_urls.h"
+#include "trie.intrinsics.h"
+
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+#include <thread>
 
 // simplified version from : http://baptiste-wicht.com/posts/2016/06/reduce-compilation-time-by-another-16-with-catch.html
 // this reduce the compliation time significantly, in favor of reduced funactionality that
@@ -14,6 +27,25 @@ void evaluate_result(const char* file, std::size_t line, const char* exp, bool v
 
 #define VERIFY(expr)  evaluate_result(__FILE__, __LINE__, #expr, (expr));
 
+// counts every heap allocation made by the test process, so tests can check that a hot path doesn't allocate
+static std::atomic<size_t> allocations_count(0);
+
+void* operator new(std::size_t size) {
+	allocations_count++;
+	auto p = std::malloc(size == 0 ? 1 : size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
 TEST_CASE("can create trie", "[trie]") {
 	trie t;
 
@@ -41,7 +73,7 @@ TEST_CASE("can add to entry that is has starts with previous", "[trie]") {
 	VERIFY(t.write("oren eini", 2) == trie::result::success);
 	VERIFY(t.entries_count() == 2);
 
-	std::pair<bool, long> read = t.try_read("oren");
+	std::pair<bool, int64_t> read = t.try_read("oren");
 	VERIFY(read.first && read.second == 1);
 
 	read = t.try_read("oren eini");
@@ -58,7 +90,7 @@ TEST_CASE("can add to entry with shared prefix with previous", "[trie]") {
 	VERIFY(t.entries_count() == 2);
 
 
-	std::pair<bool, long> read = t.try_read("oren");
+	std::pair<bool, int64_t> read = t.try_read("oren");
 	VERIFY(read.first && read.second == 1);
 
 	read = t.try_read("orange");
@@ -74,7 +106,7 @@ TEST_CASE("can add to entry that is a prefix of existing one", "[trie]") {
 	VERIFY(t.write("oren", 2) == trie::result::success);
 	VERIFY(t.entries_count() == 2);
 
-	std::pair<bool, long> read = t.try_read("oren");
+	std::pair<bool, int64_t> read = t.try_read("oren");
 	VERIFY(read.first && read.second == 2);
 
 	read = t.try_read("oren eini");
@@ -93,390 +125,31 @@ TEST_CASE("repeatedly allocating prefixes will track garbage", "[trie]") {
 	VERIFY(t.write("orange", 3) == trie::result::success);
 	VERIFY(t.entries_count() == 3);
 
+	// "or" has room for 4 children before its children array is reallocated
+	VERIFY(t.write("orbit", 4) == trie::result::success);
+	VERIFY(t.write("orchid", 5) == trie::result::success);
+	VERIFY(t.write("ordeal", 6) == trie::result::success);
+	VERIFY(t.entries_count() == 6);
+
 	VERIFY(t.available_space_before_defrag() > 0);
 	VERIFY(t.wasted_space() > 0);
 }
 
 
 TEST_CASE("can add many urls", "[trie]") {
-	std::vector<std::string>  urls = {
-		"admin/activate-hotspare",
-		"admin/backup",
-		"admin/changedbid",
-		"admin/clear-hotspare-information",
-		"admin/cluster/canJoin",
-		"admin/cluster/changeVotingMode",
-		"admin/cluster/commands/configuration",
-		"admin/cluster/commands/database/{*id}",
-		"admin/cluster/create",
-		"admin/cluster/initialize-new-cluster/{*id}",
-		"admin/cluster/join",
-		"admin/cluster/leave",
-		"admin/cluster/remove-clustering",
-		"admin/cluster/update",
-		"admin/cluster-statistics",
-		"admin/compact",
-		"admin/console/{*id}",
-		"admin/cs/{*counterStorageName}",
-		"admin/cs/{*id}",
-		"admin/cs/batch-delete",
-		"admin/cs/batch-toggle-disable",
-		"admin/databases/{*id}",
-		"admin/databases/batch-toggle-disable",
-		"admin/databases-batch-delete",
-		"admin/databases-toggle-disable",
-		"admin/databases-toggle-indexing",
-		"admin/databases-toggle-reject-clients",
-		"admin/debug/auto-tuning-info",
-		"admin/debug/info-package",
-		"admin/detailed-storage-breakdown",
-		"admin/dump",
-		"admin/fs/{*id}",
-		"admin/fs-batch-delete",
-		"admin/fs-batch-toggle-disable",
-		"admin/fs-compact",
-		"admin/fs-restore",
-		"admin/fs-toggle-disable",
-		"admin/gc",
-		"admin/generate-oauth-certificate",
-		"admin/get-hotspare-information",
-		"admin/indexingStatus",
-		"admin/ioTest",
-		"admin/killQuery",
-		"admin/license/connectivity",
-		"admin/license/forceUpdate",
-		"admin/logs/configure",
-		"admin/logs/events",
-		"admin/loh-compaction",
-		"admin/low-memory-handlers-statistics",
-		"admin/low-memory-notification",
-		"admin/optimize",
-		"admin/periodicExport/purge-tombstones",
-		"admin/replication/docs-left-to-replicate",
-		"admin/replication/export-docs-left-to-replicate",
-		"admin/replication/purge-tombstones",
-		"admin/replication/replicated-docs-by-entity-names",
-		"admin/replication/topology/discover",
-		"admin/replication/topology/global",
-		"admin/replication/topology/view",
-		"admin/replicationInfo",
-		"admin/restore",
-		"admin/serverSmuggling",
-		"admin/startIndexing",
-		"admin/startReducing",
-		"admin/stats",
-		"admin/stopIndexing",
-		"admin/stopReducing",
-		"admin/tasks",
-		"admin/test-hotspare",
-		"admin/transactions/rollbackAll",
-		"admin/ts/{*id}",
-		"admin/ts/batch-delete",
-		"admin/ts/batch-toggle-disable",
-		"admin/verify-principal",
-		"admin/voron/tree",
-		"Benchmark/EmptyMessage",
-		"bulk_docs",
-		"bulk_docs/{*id}",
-		"bulkInsert",
-		"changes/config",
-		"changes/events",
-		"clientaccesspolicy.xml",
-		"cluster/replicationState",
-		"cluster/status",
-		"cluster/topology",
-		"configuration/document/{*docId}",
-		"configuration/global/settings",
-		"configuration/periodicExportSettings",
-		"configuration/replication",
-		"configuration/settings",
-		"configuration/versioning",
-		"cs",
-		"cs/{counterStorageName}/admin/backup",
-		"cs/{counterStorageName}/admin/replication/topology/discover",
-		"cs/{counterStorageName}/admin/replication/topology/view",
-		"cs/{counterStorageName}/batch",
-		"cs/{counterStorageName}/by-prefix",
-		"cs/{counterStorageName}/change",
-		"cs/{counterStorageName}/changes/config",
-		"cs/{counterStorageName}/changes/events",
-		"cs/{counterStorageName}/counters",
-		"cs/{counterStorageName}/debug/",
-		"cs/{counterStorageName}/debug/metrics",
-		"cs/{counterStorageName}/delete",
-		"cs/{counterStorageName}/delete-by-group",
-		"cs/{counterStorageName}/getCounter",
-		"cs/{counterStorageName}/getCounterOverallTotal",
-		"cs/{counterStorageName}/groups",
-		"cs/{counterStorageName}/lastEtag",
-		"cs/{counterStorageName}/metrics",
-		"cs/{counterStorageName}/purge-tombstones",
-		"cs/{counterStorageName}/replication",
-		"cs/{counterStorageName}/replication/config",
-		"cs/{counterStorageName}/replication/heartbeat",
-		"cs/{counterStorageName}/replications/stats",
-		"cs/{counterStorageName}/reset",
-		"cs/{counterStorageName}/sinceEtag",
-		"cs/{counterStorageName}/singleAuthToken",
-		"cs/{counterStorageName}/stats",
-		"cs/{counterStorageName}/streams/groups",
-		"cs/{counterStorageName}/streams/summaries",
-		"cs/debug/counter-storages",
-		"cs/exists",
-		"c-sharp-index-definition/{*fullIndexName}",
-		"database/size",
-		"database/storage/sizes",
-		"databases",
-		"debug/auto-tuning-info",
-		"debug/cache-details",
-		"debug/changes",
-		"debug/clear-remaining-reductions",
-		"debug/config",
-		"debug/currently-indexing",
-		"debug/d0crefs-t0ps",
-		"debug/deletion-batch-stats",
-		"debug/disable-query-timing",
-		"debug/docrefs",
-		"debug/enable-query-timing",
-		"debug/filtered-out-indexes",
-		"debug/format-index",
-		"debug/gc-info",
-		"debug/identities",
-		"debug/index-fields",
-		"debug/indexing-batch-stats",
-		"debug/indexing-perf-stats",
-		"debug/indexing-perf-stats-with-timings",
-		"debug/info-package",
-		"debug/list",
-		"debug/list-all",
-		"debug/metrics",
-		"debug/plugins",
-		"debug/prefetch-status",
-		"debug/queries",
-		"debug/raw-doc",
-		"debug/reducing-batch-stats",
-		"debug/remaining-reductions",
-		"debug/replication-perf-stats",
-		"debug/request-tracing",
-		"debug/resource-drives",
-		"debug/routes",
-		"debug/sl0w-d0c-c0unts",
-		"debug/sl0w-lists-breakd0wn",
-		"debug/slow-dump-ref-csv",
-		"debug/sql-replication-perf-stats",
-		"debug/sql-replication-stats",
-		"debug/subscriptions",
-		"debug/suggest-index-merge",
-		"debug/tasks",
-		"debug/tasks/summary",
-		"debug/thread-pool",
-		"debug/transactions",
-		"debug/user-info",
-		"doc-preview",
-		"docs",
-		"docs/{*docId}",
-		"facets/{*id}",
-		"facets-multisearch",
-		"favicon.ico",
-		"fs",
-		"fs/{fileSystemName}/admin/backup",
-		"fs/{fileSystemName}/admin/optimize-index",
-		"fs/{fileSystemName}/admin/replication/topology/discover",
-		"fs/{fileSystemName}/admin/reset-index",
-		"fs/{fileSystemName}/admin/synchronization/topology/view",
-		"fs/{fileSystemName}/admin-restore",
-		"fs/{fileSystemName}/changes/config",
-		"fs/{fileSystemName}/changes/events",
-		"fs/{fileSystemName}/config",
-		"fs/{fileSystemName}/config/non-generated",
-		"fs/{fileSystemName}/config/search",
-		"fs/{fileSystemName}/files",
-		"fs/{fileSystemName}/files/{*name}",
-		"fs/{fileSystemName}/files-copy/{*name}",
-		"fs/{fileSystemName}/folders/Subdirectories/{*directory}",
-		"fs/{fileSystemName}/operation/kill",
-		"fs/{fileSystemName}/operation/status",
-		"fs/{fileSystemName}/operations",
-		"fs/{fileSystemName}/rdc/Manifest/{*id}",
-		"fs/{fileSystemName}/rdc/Signatures/{*id}",
-		"fs/{fileSystemName}/rdc/Stats",
-		"fs/{fileSystemName}/search",
-		"fs/{fileSystemName}/search/Terms",
-		"fs/{fileSystemName}/singleAuthToken",
-		"fs/{fileSystemName}/static/FavIcon",
-		"fs/{fileSystemName}/static/id",
-		"fs/{fileSystemName}/stats",
-		"fs/{fileSystemName}/storage/cleanup",
-		"fs/{fileSystemName}/storage/retryCopying",
-		"fs/{fileSystemName}/storage/retryRenaming",
-		"fs/{fileSystemName}/streams/Export",
-		"fs/{fileSystemName}/streams/files",
-		"fs/{fileSystemName}/streams/Import",
-		"fs/{fileSystemName}/streams/query",
-		"fs/{fileSystemName}/studio-tasks/check-sufficient-diskspace",
-		"fs/{fileSystemName}/studio-tasks/exportFilesystem",
-		"fs/{fileSystemName}/studio-tasks/import",
-		"fs/{fileSystemName}/studio-tasks/next-operation-id",
-		"fs/{fileSystemName}/synchronization",
-		"fs/{fileSystemName}/synchronization/Active",
-		"fs/{fileSystemName}/synchronization/applyConflict/{*fileName}",
-		"fs/{fileSystemName}/synchronization/Confirm",
-		"fs/{fileSystemName}/synchronization/Conflicts",
-		"fs/{fileSystemName}/synchronization/Finished",
-		"fs/{fileSystemName}/synchronization/Incoming",
-		"fs/{fileSystemName}/synchronization/IncrementLastETag",
-		"fs/{fileSystemName}/synchronization/LastSynchronization",
-		"fs/{fileSystemName}/synchronization/MultipartProceed",
-		"fs/{fileSystemName}/synchronization/Pending",
-		"fs/{fileSystemName}/synchronization/Rename",
-		"fs/{fileSystemName}/synchronization/ResolutionStrategyFromServerResolvers",
-		"fs/{fileSystemName}/synchronization/ResolveConflict/{*filename}",
-		"fs/{fileSystemName}/synchronization/ResolveConflicts",
-		"fs/{fileSystemName}/synchronization/start/{*filename}",
-		"fs/{fileSystemName}/synchronization/Status",
-		"fs/{fileSystemName}/synchronization/ToDestination",
-		"fs/{fileSystemName}/synchronization/ToDestinations",
-		"fs/{fileSystemName}/synchronization/UpdateMetadata/{*fileName}",
-		"fs/{fileSystemName}/traffic-watch/events",
-		"fs/admin/backup",
-		"fs/stats",
-		"fs/status",
-		"generate/code",
-		"identity/next",
-		"identity/seed",
-		"identity/seed/bulk",
-		"indexes",
-		"indexes/{*id}",
-		"indexes/last-queried",
-		"indexes/set-priority/{*id}",
-		"indexes/try-recover-corrupted",
-		"indexes-rename/{*id}",
-		"indexes-set-priority/{*id}",
-		"indexes-stats",
-		"license/status",
-		"license/support",
-		"logs/{action}",
-		"logs/fs/{action}",
-		"morelikethis/{*id}",
-		"multi_get",
-		"OAuth/API-Key",
-		"operation/alert/dismiss",
-		"operation/alerts",
-		"operation/kill",
-		"operation/status",
-		"operations",
-		"plugins/status",
-		"queries",
-		"raft/appendEntries",
-		"raft/canInstallSnapshot",
-		"raft/disconnectFromCluster",
-		"raft/installSnapshot",
-		"raft/requestVote",
-		"raft/timeoutNow",
-		"raven",
-		"raven/{*id}",
-		"reduced-database-stats",
-		"replication/explain/{*docId}",
-		"replication/forceConflictResolution",
-		"replication/heartbeat",
-		"replication/info",
-		"replication/lastEtag",
-		"replication/replicateAttachments",
-		"replication/replicateDocs",
-		"replication/replicate-indexes",
-		"replication/replicate-transformers",
-		"replication/side-by-side/",
-		"replication/topology",
-		"replication/writeAssurance",
-		"side-by-side-indexes",
-		"silverlight/{*id}",
-		"silverlight/ensureStartup",
-		"singleAuthToken",
-		"smuggler/export",
-		"static/",
-		"static/{*filename}",
-		"static/{*id}",
-		"stats",
-		"streams/docs",
-		"streams/exploration",
-		"streams/query/{*id}",
-		"studio",
-		"studio/{*path}",
-		"studio-tasks/check-sufficient-diskspace",
-		"studio-tasks/collection/counts",
-		"studio-tasks/config",
-		"studio-tasks/createSampleData",
-		"studio-tasks/createSampleDataClass",
-		"studio-tasks/exportDatabase",
-		"studio-tasks/get-sql-replication-stats",
-		"studio-tasks/import",
-		"studio-tasks/is-base-64-key",
-		"studio-tasks/latest-server-build-version",
-		"studio-tasks/loadCsvFile",
-		"studio-tasks/new-encryption-key",
-		"studio-tasks/next-operation-id",
-		"studio-tasks/replication/conflicts/resolve",
-		"studio-tasks/reset-sql-replication",
-		"studio-tasks/resolveMerge",
-		"studio-tasks/server-configs",
-		"studio-tasks/simulate-sql-replication",
-		"studio-tasks/sql-replication-toggle-disable",
-		"studio-tasks/test-sql-replication-connection",
-		"studio-tasks/validateCustomFunctions",
-		"studio-tasks/validateExportOptions",
-		"subscriptions",
-		"subscriptions/acknowledgeBatch",
-		"subscriptions/client-alive",
-		"subscriptions/close",
-		"subscriptions/create",
-		"subscriptions/open",
-		"subscriptions/pull",
-		"subscriptions/setSubscriptionAckEtag",
-		"suggest/{*id}",
-		"terms/{*id}",
-		"traffic-watch/events",
-		"transaction/commit",
-		"transaction/prepare",
-		"transaction/rollback",
-		"transaction/status",
-		"transformers",
-		"transformers/{*id}",
-		"ts",
-		"ts/{timeSeriesName}/aggregated-points/{type}",
-		"ts/{timeSeriesName}/append/{type}",
-		"ts/{timeSeriesName}/batch",
-		"ts/{timeSeriesName}/changes/config",
-		"ts/{timeSeriesName}/changes/events",
-		"ts/{timeSeriesName}/delete-key/{type}",
-		"ts/{timeSeriesName}/delete-points",
-		"ts/{timeSeriesName}/delete-range/{type}",
-		"ts/{timeSeriesName}/key/{type}",
-		"ts/{timeSeriesName}/keys/{type}",
-		"ts/{timeSeriesName}/lastEtag",
-		"ts/{timeSeriesName}/points/{type}",
-		"ts/{timeSeriesName}/replication",
-		"ts/{timeSeriesName}/replication/heartbeat",
-		"ts/{timeSeriesName}/replications/get",
-		"ts/{timeSeriesName}/replications/save",
-		"ts/{timeSeriesName}/singleAuthToken",
-		"ts/{timeSeriesName}/stats",
-		"ts/{timeSeriesName}/types",
-		"ts/{timeSeriesName}/types/{type}",
-		"ts/debug/time-serieses",
-		"ts/debug/ts/{timeSeriesName}/debug/metrics"
-	};
+	auto& urls = ravendb_urls();
 
 	trie t;
 	for (size_t i = 0; i < urls.size(); i++)
 	{
-		auto result = t.write(urls[i], (long)i);
+		auto result = t.write(urls[i], (int64_t)i);
 		VERIFY(result == trie::result::success);
 	}
 
 	for (size_t i = 0; i < urls.size(); i++)
 	{
 		auto result = t.try_read(urls[i]);
-		VERIFY(result.first && result.second == i);
+		VERIFY(result.first && result.second == (int64_t)i);
 	}
 }
 
@@ -487,17 +160,17 @@ TEST_CASE("can fill up the trie", "[trie]") {
 	size_t i = 0;
 	while (true)
 	{
-		auto result = t.write(std::to_string(i), (long)i);
+		auto result = t.write(std::to_string(i), (int64_t)i);
 		if (result != trie::result::success)
 			break;
 		i++;
 	}
-	VERIFY(t.entries_count() == i)
+	VERIFY((size_t)t.entries_count() == i)
 	for (size_t k = 0; k < i; k++)
 	{
 		auto val = t.try_read(std::to_string(k));
 
-		VERIFY(val.first && val.second == k);
+		VERIFY(val.first && val.second == (int64_t)k);
 	}
 }
 
@@ -523,3 +196,1383 @@ TEST_CASE("can remove from trie", "[trie]") {
 }
 
 
+TEST_CASE("can find children of wide nodes", "[trie]") {
+
+	trie t;
+	for (int i = 1; i < 250; i++)
+	{
+		std::string key = "route/";
+		key.push_back((char)i);
+		key += "/tail";
+		VERIFY(t.write(key, i) == trie::result::success);
+	}
+
+	for (int i = 1; i < 250; i++)
+	{
+		std::string key = "route/";
+		key.push_back((char)i);
+		key += "/tail";
+		auto read = t.try_read(key);
+		VERIFY(read.first && read.second == i);
+	}
+
+	VERIFY(t.try_read(std::string("route/\xff/tail")).first == false);
+	VERIFY(t.try_read("route/").first == false);
+}
+
+
+TEST_CASE("children grow and shrink with writes and removes", "[trie]") {
+
+	trie t;
+	for (int i = 0; i < 256; i++)
+	{
+		std::string key = "k";
+		key.push_back((char)i);
+		VERIFY(t.write(key, i) == trie::result::success);
+	}
+	VERIFY(t.entries_count() == 256);
+
+	for (int i = 0; i < 256; i++)
+	{
+		std::string key = "k";
+		key.push_back((char)i);
+		auto read = t.try_read(key);
+		VERIFY(read.first && read.second == i);
+	}
+
+	for (int i = 0; i < 256; i += 2)
+	{
+		std::string key = "k";
+		key.push_back((char)i);
+		VERIFY(t.remove(key));
+		VERIFY(t.remove(key) == false);
+	}
+	VERIFY(t.entries_count() == 128);
+
+	for (int i = 0; i < 256; i++)
+	{
+		std::string key = "k";
+		key.push_back((char)i);
+		auto read = t.try_read(key);
+		VERIFY(read.first == (i % 2 == 1));
+	}
+
+	t.defrag();
+
+	for (int i = 1; i < 256; i += 2)
+	{
+		std::string key = "k";
+		key.push_back((char)i);
+		auto read = t.try_read(key);
+		VERIFY(read.first && read.second == i);
+		VERIFY(t.remove(key));
+	}
+	VERIFY(t.entries_count() == 0);
+
+	VERIFY(t.write("k", 1) == trie::result::success);
+	auto read = t.try_read("k");
+	VERIFY(read.first && read.second == 1);
+}
+
+
+TEST_CASE("removing a leaf keeps its siblings reachable", "[trie]") {
+
+	trie t;
+	VERIFY(t.write("users/1", 1) == trie::result::success);
+	VERIFY(t.write("users/2", 2) == trie::result::success);
+	VERIFY(t.write("users/3/orders", 3) == trie::result::success);
+
+	VERIFY(t.remove("users/3/orders"));
+	VERIFY(t.try_read("users/3/orders").first == false);
+	VERIFY(t.try_read("users/1").second == 1);
+	VERIFY(t.try_read("users/2").second == 2);
+
+	VERIFY(t.write("users/3/orders", 4) == trie::result::success);
+	VERIFY(t.try_read("users/3/orders").second == 4);
+}
+
+
+TEST_CASE("empty key is not confused with the first key", "[trie]") {
+
+	trie t;
+	VERIFY(t.write("abc", 1) == trie::result::success);
+	VERIFY(t.try_read("").first == false);
+	VERIFY(t.remove("") == false);
+
+	VERIFY(t.write("", 2) == trie::result::success);
+	VERIFY(t.entries_count() == 2);
+	VERIFY(t.try_read("").second == 2);
+	VERIFY(t.try_read("abc").second == 1);
+}
+
+
+TEST_CASE("can match keys that differ after the first word", "[trie]") {
+
+	trie t;
+	VERIFY(t.write("databases/northwind/docs", 1) == trie::result::success);
+	VERIFY(t.write("databases/northwind/indexes", 2) == trie::result::success);
+	VERIFY(t.write("databases/northwind", 3) == trie::result::success);
+
+	VERIFY(t.try_read("databases/northwind/docs").second == 1);
+	VERIFY(t.try_read("databases/northwind/indexes").second == 2);
+	VERIFY(t.try_read("databases/northwind").second == 3);
+	VERIFY(t.try_read("databases/northwind/doc").first == false);
+	VERIFY(t.try_read("databases/northwinds").first == false);
+	VERIFY(t.try_read("databases/northwind/docs/1").first == false);
+}
+
+
+TEST_CASE("lookups on buffer slices don't allocate", "[trie]") {
+
+	// keys much longer than the small string optimization, as they come from the network
+	const char request[] = "GET /databases/northwind/indexes/orders-by-company-and-employee HTTP/1.1\r\n"
+		"GET /databases/northwind/indexes/orders-by-company-and-product HTTP/1.1\r\n";
+	const size_t line_size = sizeof("GET /databases/northwind/indexes/orders-by-company-and-employee HTTP/1.1\r\n") - 1;
+
+	trie t;
+	VERIFY(t.write(std::string_view(request + 5, 58), 1) == trie::result::success);
+	VERIFY(t.write(request + line_size + 5, 57, 2) == trie::result::success);
+
+	size_t before = allocations_count;
+	for (int i = 0; i < 1000; i++)
+	{
+		auto first = t.try_read(std::string_view(request + 5, 58));
+		auto second = t.try_read(request + line_size + 5, 57);
+		auto missing = t.try_read(request + 5, 40);
+		if (first.second != 1 || second.second != 2 || missing.first)
+			break;
+	}
+	auto overwrite = t.write(request + 5, 58, 3);
+	auto removed = t.remove(request + line_size + 5, 57);
+	auto allocations = allocations_count - before;
+
+	VERIFY(allocations == 0);
+	VERIFY(overwrite == trie::result::success);
+	VERIFY(removed);
+
+	VERIFY(t.try_read(std::string_view(request + 5, 58)).second == 3);
+	VERIFY(t.try_read(std::string_view(request + line_size + 5, 57)).first == false);
+}
+
+
+TEST_CASE("can read many keys at once", "[trie]") {
+
+	trie t;
+	for (long i = 0; i < 800; i++)
+	{
+		VERIFY(t.write(std::to_string(i * 7), i) == trie::result::success);
+	}
+
+	std::vector<std::string> keys;
+	for (long i = 0; i < 1500; i++)
+	{
+		keys.push_back(std::to_string(i * 7 + (i % 3 == 0 ? 1 : 0)));
+	}
+	keys.push_back("");
+	std::vector<std::string_view> views(keys.begin(), keys.end());
+	std::vector<std::pair<bool, int64_t>> results(views.size());
+
+	t.try_read_many(views.data(), views.size(), results.data());
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		auto expected = t.try_read(keys[i]);
+		VERIFY(results[i] == expected);
+	}
+	VERIFY(results[4].first && results[4].second == 4);
+	VERIFY(results[6].first == false);
+	VERIFY(results.back().first == false);
+}
+
+
+TEST_CASE("can bulk load sorted urls without garbage", "[trie]") {
+
+	auto urls = ravendb_urls();
+	std::sort(urls.begin(), urls.end());
+
+	std::vector<std::pair<std::string_view, int64_t>> items;
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		items.push_back(std::make_pair(std::string_view(urls[i]), (int64_t)i));
+	}
+
+	trie t;
+	VERIFY(t.write("will be replaced", 1) == trie::result::success);
+	VERIFY(t.bulk_load(items.data(), items.size()) == trie::result::success);
+	VERIFY((size_t)t.entries_count() == urls.size());
+	VERIFY(t.wasted_space() == 0);
+	VERIFY(t.try_read("will be replaced").first == false);
+
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		auto result = t.try_read(urls[i]);
+		VERIFY(result.first && result.second == (int64_t)i);
+	}
+	VERIFY(t.try_read("admin/cluster").first == false);
+
+	VERIFY(t.write("admin/cluster", -1) == trie::result::success);
+	VERIFY(t.try_read("admin/cluster").second == -1);
+	VERIFY(t.try_read(urls[0]).second == 0);
+}
+
+
+TEST_CASE("bulk load rejects unsorted or oversized input", "[trie]") {
+
+	trie t;
+	std::pair<std::string_view, int64_t> unsorted[] = { { "b", 1 }, { "a", 2 } };
+	VERIFY(t.bulk_load(unsorted, 2) == trie::result::keys_not_sorted);
+
+	std::pair<std::string_view, int64_t> duplicates[] = { { "a", 1 }, { "a", 2 } };
+	VERIFY(t.bulk_load(duplicates, 2) == trie::result::keys_not_sorted);
+
+	std::string large(300, 'x');
+	std::pair<std::string_view, int64_t> too_large[] = { { large, 1 } };
+	VERIFY(t.bulk_load(too_large, 1) == trie::result::key_too_large);
+
+	std::vector<std::string> keys;
+	for (int i = 0; i < 10000; i++)
+	{
+		keys.push_back(std::to_string(i));
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<std::pair<std::string_view, int64_t>> items;
+	for (auto& key : keys)
+	{
+		items.push_back(std::make_pair(std::string_view(key), (int64_t)1));
+	}
+	VERIFY(t.bulk_load(items.data(), items.size()) == trie::result::not_enough_space);
+	VERIFY(t.entries_count() == 0);
+	VERIFY(t.write("a", 1) == trie::result::success);
+}
+
+
+TEST_CASE("writes that defrag don't allocate", "[trie]") {
+
+	trie t;
+	std::vector<std::string> keys;
+	for (int i = 0; t.available_space_before_defrag() > 1024; i++)
+	{
+		keys.push_back("sessions/" + std::to_string(i));
+		VERIFY(t.write(keys.back(), i) == trie::result::success);
+	}
+	for (size_t i = 0; i < keys.size(); i += 2)
+	{
+		VERIFY(t.remove(keys[i]));
+	}
+
+	// keys that are too large for the holes the removed ones left behind
+	std::vector<std::string> renewed_keys;
+	for (size_t i = 0; i < keys.size(); i += 2)
+	{
+		renewed_keys.push_back(keys[i] + "/renewed/with/a/key/larger/than/before");
+	}
+
+	// the first defrag on a thread allocates the scratch it keeps for the rest
+	trie().defrag();
+
+	// keep writing until the trie runs out of room and has to defrag
+	size_t before = allocations_count;
+	auto space_before_writes = t.available_space_before_defrag();
+	bool defragged = false;
+	bool all_written = true;
+	for (size_t i = 0; i < renewed_keys.size() && defragged == false; i++)
+	{
+		all_written &= t.write(renewed_keys[i], -1) == trie::result::success;
+		defragged = t.available_space_before_defrag() > space_before_writes;
+	}
+	auto allocations = allocations_count - before;
+
+	VERIFY(all_written);
+	VERIFY(defragged);
+	VERIFY(allocations == 0);
+	for (size_t i = 1; i < keys.size(); i += 2)
+	{
+		VERIFY(t.try_read(keys[i]).second == (int64_t)i);
+	}
+}
+
+
+TEST_CASE("defrag steps compact the trie a bit at a time", "[trie]") {
+
+	trie t;
+	std::vector<std::string> keys;
+	for (int i = 0; t.available_space_before_defrag() > 1024; i++)
+	{
+		keys.push_back("sessions/" + std::to_string(i));
+		VERIFY(t.write(keys.back(), i) == trie::result::success);
+	}
+	for (size_t i = 0; i < keys.size(); i += 2)
+	{
+		VERIFY(t.remove(keys[i]));
+	}
+
+	auto wasted = t.wasted_space();
+	auto available = t.available_space_before_defrag();
+	VERIFY(wasted > 0);
+
+	int steps = 1;
+	while (t.defrag_step(512) == false)
+		steps++;
+
+	VERIFY(steps > 10);
+	VERIFY(t.wasted_space() == 0);
+	VERIFY(t.available_space_before_defrag() == available + wasted);
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		auto read = t.try_read(keys[i]);
+		VERIFY(read.first == (i % 2 == 1));
+		VERIFY(read.first == false || read.second == (int64_t)i);
+	}
+}
+
+
+TEST_CASE("writes keep up with the garbage once over the compaction threshold", "[trie]") {
+
+	trie t;
+	t.set_compaction_policy(2048, 1024);
+
+	size_t max_wasted = 0;
+	for (int i = 0; i < 20000; i++)
+	{
+		VERIFY(t.write("sessions/" + std::to_string(i), i) == trie::result::success);
+		if (i >= 500)
+			VERIFY(t.remove("sessions/" + std::to_string(i - 500)));
+		max_wasted = std::max(max_wasted, (size_t)t.wasted_space());
+	}
+
+	// without the policy, the garbage grows until the trie is full and has to be defragged in one go
+	VERIFY(max_wasted < 4096);
+
+	VERIFY(t.entries_count() == 500);
+	VERIFY(t.try_read("sessions/19999").second == 19999);
+	VERIFY(t.try_read("sessions/19499").first == false);
+}
+
+
+TEST_CASE("churn reuses the space of removed entries", "[trie]") {
+
+	trie t;
+	for (int i = 0; i < 200; i++)
+	{
+		VERIFY(t.write("sessions/" + std::to_string(i), i) == trie::result::success);
+	}
+
+	// without reusing the holes, the trie would run out of room and defrag many times over
+	int min_available = t.available_space_before_defrag();
+	for (int i = 200; i < 20000; i++)
+	{
+		VERIFY(t.remove("sessions/" + std::to_string(i - 200)));
+		VERIFY(t.write("sessions/" + std::to_string(i), i) == trie::result::success);
+		min_available = std::min(min_available, t.available_space_before_defrag());
+	}
+
+	VERIFY(min_available > trie::BUFFER_SIZE / 2);
+	VERIFY(t.entries_count() == 200);
+	VERIFY(t.try_read("sessions/19800").second == 19800);
+	VERIFY(t.try_read("sessions/19799").first == false);
+}
+
+
+TEST_CASE("iterates over the entries in key order", "[trie]") {
+
+	trie t;
+	std::map<std::string, int64_t> expected;
+	auto& urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		VERIFY(t.write(urls[i], (int64_t)i) == trie::result::success);
+		expected[urls[i]] = (int64_t)i;
+	}
+	VERIFY(t.write("", -1) == trie::result::success);
+	expected[""] = -1;
+
+	size_t before = allocations_count;
+	size_t count = 0;
+	bool in_order = true;
+	auto it = expected.begin();
+	for (auto entry : t)
+	{
+		in_order &= it != expected.end() && entry.first == it->first && entry.second == it->second;
+		++it;
+		count++;
+	}
+	auto allocations = allocations_count - before;
+
+	VERIFY(in_order);
+	VERIFY(count == expected.size());
+	VERIFY(allocations == 0);
+}
+
+
+TEST_CASE("lower bound finds the first key that is not less", "[trie]") {
+
+	trie t;
+	std::map<std::string, int64_t> expected;
+	for (auto key : { "admin/cluster", "admin/cluster/nodes", "admin/databases", "databases", "databases/docs", "\xff" })
+	{
+		VERIFY(t.write(key, (int64_t)expected.size()) == trie::result::success);
+		expected[key] = (int64_t)expected.size();
+	}
+
+	for (auto key : { "", "a", "admin/cluster", "admin/cluster/", "admin/clusters", "admin/d", "b", "databases/", "databases/docs/1", "\xfe", "\xff", "\xff\x01" })
+	{
+		auto it = t.lower_bound(key);
+		auto expected_it = expected.lower_bound(key);
+		if (expected_it == expected.end())
+		{
+			VERIFY(it == t.end());
+		}
+		else
+		{
+			VERIFY(it != t.end());
+			VERIFY((*it).first == expected_it->first);
+			VERIFY((*it).second == expected_it->second);
+		}
+	}
+}
+
+
+TEST_CASE("can count and scan keys by prefix", "[trie]") {
+
+	trie t;
+	auto& urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		VERIFY(t.write(urls[i], (int64_t)i) == trie::result::success);
+	}
+
+	for (auto prefix : { "", "admin/", "admin/cluster", "admin/cluster/", "databases/{databaseName}/", "d", "no/such/prefix", "admin/cs/{*counterStorageName}/x" })
+	{
+		std::vector<std::string> expected;
+		for (auto& url : urls)
+		{
+			if (url.compare(0, std::strlen(prefix), prefix) == 0)
+				expected.push_back(url);
+		}
+		std::sort(expected.begin(), expected.end());
+		expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+		std::vector<std::string> scanned;
+		t.for_each_with_prefix(prefix, [&](std::string_view key, int64_t value) {
+			scanned.push_back(std::string(key));
+			VERIFY(urls[value] == key);
+		});
+
+		VERIFY(t.count_prefix(prefix) == (int)expected.size());
+		VERIFY(scanned == expected);
+	}
+
+	auto in_cluster = t.count_prefix("admin/cluster/");
+	VERIFY(t.remove("admin/cluster/create"));
+	VERIFY(t.count_prefix("admin/cluster/create") == 0);
+	VERIFY(t.count_prefix("admin/cluster/") == in_cluster - 1);
+}
+
+
+TEST_CASE("finds the longest stored prefix of a path", "[trie]") {
+
+	trie t;
+	auto& urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		VERIFY(t.write(urls[i], (int64_t)i) == trie::result::success);
+	}
+
+	for (auto path : { "admin/cluster/topology", "admin/cluster/topology?nodeTag=A", "admin/cluster", "admin/", "", 
+		"databases/{databaseName}/docs/users/1", "nothing/matches" })
+	{
+		std::string_view path_view(path);
+		size_t expected_length = 0;
+		bool expected_found = false;
+		for (auto& url : urls)
+		{
+			if (path_view.substr(0, url.length()) == url && url.length() >= expected_length)
+			{
+				expected_length = url.length();
+				expected_found = true;
+			}
+		}
+
+		auto match = t.longest_prefix_match(path);
+		VERIFY(std::get<0>(match) == expected_found);
+		VERIFY(std::get<1>(match) == expected_length);
+		VERIFY(expected_found == false || urls[std::get<2>(match)] == path_view.substr(0, expected_length));
+	}
+
+	VERIFY(t.write("", -1) == trie::result::success);
+	VERIFY(t.longest_prefix_match("nothing/matches") == std::make_tuple(true, (size_t)0, (int64_t)-1));
+}
+
+
+TEST_CASE("can match paths to route templates", "[trie]") {
+
+	trie t;
+	auto& urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		VERIFY(t.write_route(urls[i], (int64_t)i) == trie::result::success);
+	}
+
+	std::string_view captures[4];
+	size_t captured;
+
+	auto match = t.match_route("cs/sales/counters", captures, 4, captured);
+	VERIFY(match.first && urls[match.second] == "cs/{counterStorageName}/counters");
+	VERIFY(captured == 1 && captures[0] == "sales");
+
+	match = t.match_route("admin/cs/sales/extra/segments", captures, 4, captured);
+	VERIFY(match.first && urls[match.second] == "admin/cs/{*id}");
+	VERIFY(captured == 1 && captures[0] == "sales/extra/segments");
+
+	match = t.match_route("debug/routes", captures, 4, captured);
+	VERIFY(match.first && urls[match.second] == "debug/routes");
+	VERIFY(captured == 0);
+
+	VERIFY(t.match_route("cs//counters", captures, 4, captured).first == false);
+	VERIFY(t.match_route("no/such/route", captures, 4, captured).first == false);
+}
+
+
+TEST_CASE("literal route segments win over placeholders, and backtrack to them", "[trie]") {
+
+	trie t;
+	VERIFY(t.write_route("users/me", 1) == trie::result::success);
+	VERIFY(t.write_route("users/{id}", 2) == trie::result::success);
+	VERIFY(t.write_route("users/{id}/orders/{orderId}", 3) == trie::result::success);
+	VERIFY(t.write_route("users/{*rest}", 4) == trie::result::success);
+
+	std::string_view captures[4];
+	size_t captured;
+
+	VERIFY(t.match_route("users/me", captures, 4, captured) == std::make_pair(true, (int64_t)1));
+	VERIFY(captured == 0);
+
+	VERIFY(t.match_route("users/1", captures, 4, captured) == std::make_pair(true, (int64_t)2));
+	VERIFY(captured == 1 && captures[0] == "1");
+
+	// the literal "me" leads nowhere, so the match goes back to the parameter
+	VERIFY(t.match_route("users/me/orders/7", captures, 4, captured) == std::make_pair(true, (int64_t)3));
+	VERIFY(captured == 2 && captures[0] == "me" && captures[1] == "7");
+
+	VERIFY(t.match_route("users/1/orders", captures, 4, captured) == std::make_pair(true, (int64_t)4));
+	VERIFY(captured == 1 && captures[0] == "1/orders");
+}
+
+
+TEST_CASE("small tries work within their page", "[trie]") {
+
+	small_trie t;
+	int written = 0;
+	while (t.write("users/" + std::to_string(written), written) == trie::result::success)
+		written++;
+
+	VERIFY(written > 100);
+	VERIFY(t.entries_count() == written);
+	for (int i = 0; i < written; i++)
+		VERIFY(t.try_read("users/" + std::to_string(i)).second == i);
+
+	for (int i = 0; i < written; i += 2)
+		VERIFY(t.remove("users/" + std::to_string(i)));
+	t.defrag();
+	VERIFY(t.wasted_space() == 0);
+	VERIFY(t.write("users/more", -1) == trie::result::success);
+	VERIFY(t.try_read("users/1").second == 1);
+}
+
+
+TEST_CASE("large tries hold more entries than 16 bit offsets can address", "[trie]") {
+
+	// too big for the stack
+	auto t = std::make_unique<large_trie>();
+	const int count = 60000;
+	for (int i = 0; i < count; i++)
+		VERIFY(t->write("documents/" + std::to_string(i), i) == trie::result::success);
+
+	VERIFY(t->entries_count() == count);
+	VERIFY(t->count_prefix("documents/9") == 1111);
+
+	for (int i = 0; i < count; i += 2)
+		VERIFY(t->remove("documents/" + std::to_string(i)));
+	t->defrag();
+	VERIFY(t->wasted_space() == 0);
+
+	long expected = 1;
+	for (auto entry : *t) {
+		(void)entry;
+		expected += 2;
+	}
+	VERIFY(expected == count + 1);
+	for (int i = 0; i < count; i++)
+		VERIFY(t->try_read("documents/" + std::to_string(i)).first == (i % 2 == 1));
+}
+
+
+// Writes and removes random keys of up to max_size of the letters, few enough that the keys share most of their
+// prefixes, so nodes are split and shrunk all the time. Checks the trie against a std::map and with validate
+// after every operation.
+template<typename Trie>
+void churn_against_map(Trie& t, uint64_t seed, int operations_count, std::string_view letters, size_t max_size) {
+	std::mt19937_64 random(seed);
+	std::map<std::string, int64_t> expected;
+	for (int i = 0; i < operations_count; i++) {
+		std::string key;
+		for (auto size = 1 + random() % max_size; size > 0; size--)
+			key += letters[random() % letters.size()];
+
+		if (random() % 3 == 0) {
+			VERIFY(t.remove(key) == (expected.erase(key) == 1));
+		}
+		else {
+			auto result = t.write(key, i);
+			VERIFY(result == trie::result::success || result == trie::result::not_enough_space);
+			if (result == trie::result::success)
+				expected[key] = i;
+		}
+
+		trie::validation_report report;
+		auto valid = t.validate(report);
+		VERIFY(valid);
+		if (valid == false)
+			return;
+		auto read = t.try_read(key);
+		auto it = expected.find(key);
+		VERIFY(read.first == (it != expected.end()));
+		VERIFY(read.first == false || read.second == it->second);
+	}
+
+	VERIFY(t.entries_count() == (int)expected.size());
+	auto it = expected.begin();
+	for (auto entry : t) {
+		VERIFY(it != expected.end() && entry.first == it->first && entry.second == it->second);
+		++it;
+	}
+}
+
+
+TEST_CASE("large tries keep their blocks apart through splits, shrinks and removes", "[trie]") {
+
+	// the remainder of a shrunk node used to be too small for a block header of 32 bit offsets
+	auto t = std::make_unique<large_trie>();
+	std::pair<std::string_view, int64_t> items[] = { { "abcde1", 1 }, { "abcde2", 2 } };
+	VERIFY(t->bulk_load(items, 2) == trie::result::success);
+	VERIFY(t->write("abcdX", 3) == trie::result::success);
+	trie::validation_report report;
+	VERIFY(t->validate(report));
+	t->defrag_step(1000000);
+	VERIFY(t->validate(report));
+	VERIFY(t->try_read("abcde2").second == 2);
+	VERIFY(t->try_read("abcdX").second == 3);
+
+	for (uint64_t seed = 1; seed <= 4; seed++) {
+		auto churned = std::make_unique<large_trie>();
+		churn_against_map(*churned, seed, 2000, "abcdeX12", 12);
+	}
+}
+
+
+TEST_CASE("full tries take what fits and say not_enough_space for the rest", "[trie]") {
+
+	// a split frees part of the node it splits, so the new child that comes after it may not find room in one piece
+	for (uint64_t seed = 1; seed <= 20; seed++) {
+		small_trie small;
+		churn_against_map(small, seed, 1000, "ab", 12);
+		small_trie four_letters;
+		churn_against_map(four_letters, seed, 1000, "abcd", 4);
+	}
+	for (uint64_t seed = 1; seed <= 2; seed++) {
+		trie t;
+		churn_against_map(t, seed, 4000, "ab", 12);
+	}
+}
+
+
+TEST_CASE("every write that adds an entry stops at the most entries the offsets can count", "[trie]") {
+
+	trie t;
+	VERIFY(t.write("abcd", 1) == trie::result::success);
+	VERIFY(t.write("abce", 2) == trie::result::success);
+
+	// the count is the third field of the header, there isn't room for this many entries otherwise
+	const size_t count_offset = 2 * sizeof(short);
+	short count = std::numeric_limits<short>::max();
+	std::memcpy((char*)&t + count_offset, &count, sizeof(count));
+	VERIFY(t.write("abc", 3) == trie::result::max_number_of_items_stored); // a value on a node that has none
+	VERIFY(t.write("ab", 3) == trie::result::max_number_of_items_stored); // a split where the key ends
+	VERIFY(t.write("abx", 3) == trie::result::max_number_of_items_stored); // a split and a new child
+	VERIFY(t.write("abcf", 3) == trie::result::max_number_of_items_stored); // a new child
+	VERIFY(t.write("abcd", 3) == trie::result::success); // replacing a value adds nothing
+
+	count = 2;
+	std::memcpy((char*)&t + count_offset, &count, sizeof(count));
+	trie::validation_report report;
+	VERIFY(t.validate(report));
+	VERIFY(t.try_read("abc").first == false);
+	VERIFY(t.try_read("abcd").second == 3);
+}
+
+
+TEST_CASE("paged trie splits its pages to hold more than a single page can", "[trie]") {
+
+	paged_trie t;
+	const int count = 200000;
+	// in an order that is neither sorted nor reversed, so splits happen all over the key range
+	for (int i = 0; i < count; i++)
+	{
+		auto n = (int)(((long long)i * 7919) % count);
+		VERIFY(t.write("keys/" + std::to_string(n), n) == trie::result::success);
+	}
+
+	VERIFY(t.entries_count() == count);
+	VERIFY(t.height() > 0);
+	VERIFY(t.pages_count() > 10);
+	t.validate();
+
+	for (int i = 0; i < count; i++)
+		VERIFY(t.try_read("keys/" + std::to_string(i)) == std::make_pair(true, (int64_t)i));
+	VERIFY(t.try_read("keys/").first == false);
+	VERIFY(t.try_read("keys/" + std::to_string(count)).first == false);
+
+	for (int i = 0; i < count; i += 3)
+		VERIFY(t.remove("keys/" + std::to_string(i)));
+	VERIFY(t.remove("keys/0") == false);
+	VERIFY(t.write("keys/1", -1) == trie::result::success);
+	VERIFY(t.entries_count() == count - (count + 2) / 3);
+	VERIFY(t.try_read("keys/1").second == -1);
+	VERIFY(t.try_read("keys/3").first == false);
+}
+
+
+TEST_CASE("mapped trie is used in place from its file", "[trie]") {
+
+	const char* path = "mapped_trie.test";
+	std::remove(path);
+
+	mapped_trie readonly_missing;
+	VERIFY(readonly_missing.open(path, mapped_file::read_only) == false);
+
+	{
+		mapped_trie t;
+		VERIFY(t.open(path, mapped_file::read_write));
+		VERIFY(t.writer()->entries_count() == 0);
+		for (int i = 0; i < 500; i++)
+			VERIFY(t.writer()->write("routes/" + std::to_string(i), i) == trie::result::success);
+		VERIFY(t.flush());
+	}
+
+	mapped_trie reader, other_reader;
+	VERIFY(reader.open(path, mapped_file::read_only));
+	VERIFY(other_reader.open(path, mapped_file::read_only));
+	VERIFY(reader.writer() == nullptr);
+	VERIFY(reader.reader().entries_count() == 500);
+	for (int i = 0; i < 500; i++)
+		VERIFY(other_reader.reader().try_read("routes/" + std::to_string(i)) == std::make_pair(true, (int64_t)i));
+
+	// the writer changes the same pages the readers see
+	mapped_trie writer;
+	VERIFY(writer.open(path, mapped_file::read_write));
+	VERIFY(writer.writer()->write("routes/new", -1) == trie::result::success);
+	VERIFY(reader.reader().try_read("routes/new").second == -1);
+
+	reader.close();
+	other_reader.close();
+	writer.close();
+
+	// a file of another size isn't a trie
+	basic_mapped_trie<small_trie> wrong_size;
+	VERIFY(wrong_size.open(path, mapped_file::read_write) == false);
+
+	// nor is one that was damaged after it was closed
+	{
+		std::FILE* file = std::fopen(path, "r+b");
+		std::fseek(file, 100, SEEK_SET);
+		auto byte = std::fgetc(file);
+		std::fseek(file, 100, SEEK_SET);
+		std::fputc(byte ^ 1, file);
+		std::fclose(file);
+	}
+	VERIFY(reader.open(path, mapped_file::read_only) == false);
+	VERIFY(reader.is_open() == false);
+	std::remove(path);
+
+	// a writer that stops before it flushes or closes leaves a stale checksum, which a copy of the file keeps
+	const char* crashed_path = "mapped_trie.crashed.test";
+	{
+		mapped_trie t;
+		VERIFY(t.open(path, mapped_file::read_write));
+		VERIFY(t.writer()->write("routes/1", 1) == trie::result::success);
+		VERIFY(t.flush());
+		VERIFY(t.writer()->write("routes/2", 2) == trie::result::success);
+
+		std::vector<char> bytes(trie::BUFFER_SIZE);
+		std::FILE* file = std::fopen(path, "rb");
+		VERIFY(std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size());
+		std::fclose(file);
+		file = std::fopen(crashed_path, "wb");
+		VERIFY(std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+		std::fclose(file);
+	}
+	VERIFY(reader.open(crashed_path, mapped_file::read_only) == false);
+	{
+		mapped_trie recovered;
+		VERIFY(recovered.open(crashed_path, mapped_file::read_write));
+		VERIFY(recovered.reader().try_read("routes/2") == std::make_pair(true, (int64_t)2));
+	}
+	VERIFY(reader.open(crashed_path, mapped_file::read_only));
+	VERIFY(reader.reader().entries_count() == 2);
+	reader.close();
+	std::remove(crashed_path);
+	std::remove(path);
+
+	// a file that was created but can't be mapped isn't left behind
+	mapped_file empty;
+	bool created = false;
+	VERIFY(empty.open(path, mapped_file::read_write, 0, created) == false);
+	VERIFY(created == false);
+	VERIFY(std::fopen(path, "rb") == nullptr);
+}
+
+
+TEST_CASE("serialized tries load back, and are checked first", "[trie]") {
+
+	trie t;
+	auto urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+		VERIFY(t.write(urls[i], (int64_t)i << 40) == trie::result::success);
+	for (size_t i = 0; i < urls.size(); i += 5)
+		VERIFY(t.remove(urls[i]));
+
+	// 8 byte aligned, as view requires
+	std::vector<int64_t> storage(t.serialized_size() / sizeof(int64_t) + 1);
+	auto data = (char*)storage.data();
+	t.serialize(data);
+	auto size = t.serialized_size();
+
+	trie loaded;
+	VERIFY(loaded.load(data, size) == trie::result::success);
+	trie::result result;
+	auto view = trie::view(data, size, result);
+	VERIFY(result == trie::result::success && view != nullptr);
+	for (size_t i = 0; i < urls.size(); i++)
+	{
+		auto expected = i % 5 == 0 ? std::make_pair(false, (int64_t)0) : std::make_pair(true, (int64_t)i << 40);
+		VERIFY(loaded.try_read(urls[i]) == expected);
+		VERIFY(view->try_read(urls[i]) == expected);
+	}
+	VERIFY(loaded.write("a/new/entry", 1) == trie::result::success);
+
+	// misaligned data can still be loaded, but not viewed
+	std::vector<int64_t> shifted_storage(storage.size() + 1);
+	auto shifted = (char*)shifted_storage.data() + 4;
+	std::memcpy(shifted, data, size);
+	VERIFY(trie::view(shifted, size, result) == nullptr && result == trie::result::invalid_format);
+	trie reloaded;
+	VERIFY(reloaded.load(shifted, size) == trie::result::success);
+	VERIFY(reloaded.try_read(urls[1]).second == (int64_t)1 << 40);
+
+	// the same format as a smaller page, as long as it fits, but not with wider offsets
+	small_trie small;
+	VERIFY(small.load(data, size) == (size <= (size_t)small_trie::BUFFER_SIZE ? trie::result::success : trie::result::invalid_format));
+	VERIFY(large_trie::view(data, size, result) == nullptr && result == trie::result::invalid_format);
+	VERIFY(loaded.load(data, size - 4) == trie::result::invalid_format);
+
+	data[size / 2] ^= 1;
+	VERIFY(loaded.load(data, size) == trie::result::checksum_mismatch);
+	VERIFY(trie::view(data, size, result) == nullptr && result == trie::result::checksum_mismatch);
+	VERIFY(loaded.try_read("a/new/entry").second == 1);
+
+	// a checksum is no guard against data made to pass it, here a root whose children are outside of the trie
+	auto crafted = t.snapshot();
+	auto crafted_base = (char*)crafted.get();
+	short root_offset;
+	std::memcpy(&root_offset, crafted_base + 4 * sizeof(short), sizeof(short));
+	short outside = 0x7000;
+	std::memcpy(crafted_base + root_offset + 2 * sizeof(short), &outside, sizeof(short));
+	crafted->serialize(data);
+	VERIFY(trie::view(data, size, result) == nullptr && result == trie::result::invalid_format);
+	VERIFY(loaded.load(data, size) == trie::result::invalid_format);
+	VERIFY(loaded.try_read("a/new/entry").second == 1);
+}
+
+
+TEST_CASE("validate reports the first problem without allocating", "[trie]") {
+
+	// the instructions, when the CPU has them, and the table agree on every length and alignment
+	const char* check = "123456789";
+	VERIFY(crc32c(0, check, 9) == 0xE3069283);
+	VERIFY(crc32c_table(0, check, 9) == 0xE3069283);
+	std::string text(300, 'x');
+	for (size_t i = 0; i < text.size(); i++)
+		text[i] = (char)(i * 31 + 7);
+	for (size_t start = 0; start < 9; start++)
+		VERIFY(crc32c(crc32c(0, text.data(), start), text.data() + start, text.size() - start) == crc32c_table(0, text.data(), text.size()));
+
+	trie t;
+	auto urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++)
+		VERIFY(t.write(urls[i], (int64_t)i) == trie::result::success);
+	for (size_t i = 0; i < urls.size(); i += 3)
+		VERIFY(t.remove(urls[i]));
+
+	trie::validation_report report;
+	size_t allocations_before = allocations_count;
+	bool valid = t.validate(report);
+	auto allocations = allocations_count - allocations_before;
+	VERIFY(valid);
+	VERIFY(allocations == 0);
+	VERIFY(report.error == trie::valid && report.message == nullptr);
+
+	// the checksum is only set by defrag, or when asked to
+	VERIFY(t.verify_checksum() == false);
+	t.defrag();
+	VERIFY(t.verify_checksum());
+	VERIFY(t.write("one/more", 1) == trie::result::success);
+	VERIFY(t.verify_checksum() == false);
+	t.update_checksum();
+	VERIFY(t.verify_checksum());
+
+	// damage every byte in turn, validate must never read outside of the trie, and must catch whatever it can
+	std::vector<char> original(sizeof(trie));
+	std::memcpy(original.data(), (char*)&t, sizeof(trie));
+	auto damaged = std::make_unique<trie>();
+	int caught = 0;
+	for (size_t i = 0; i < t.serialized_size(); i++) {
+		std::memcpy((char*)damaged.get(), original.data(), sizeof(trie));
+		((char*)damaged.get())[i] ^= 0x40;
+		VERIFY(damaged->verify_checksum() == false);
+		if (damaged->validate(report) == false) {
+			caught++;
+			VERIFY(report.error != trie::valid && report.message != nullptr);
+			VERIFY(report.offset >= 0 && report.offset < trie::BUFFER_SIZE);
+		}
+	}
+	VERIFY(caught > 0);
+}
+
+
+TEST_CASE("concurrent trie readers see every write whole, while it happens", "[trie]") {
+
+	auto shared = std::make_unique<concurrent_trie<trie>>();
+	auto urls = ravendb_urls();
+	std::atomic<bool> done(false);
+	std::atomic<int> wrong_values(0);
+	std::atomic<int> reads(0);
+
+	// the writer keeps changing every entry, and defragging, the values always say which url they belong to
+	std::thread writer([&]() {
+		for (int round = 0; round < 20; round++) {
+			for (size_t i = 0; i < urls.size(); i++)
+				shared->write(urls[i], (int64_t)round << 32 | (int64_t)i);
+			for (size_t i = round % 2; i < urls.size(); i += 2)
+				shared->remove(urls[i]);
+			shared->defrag();
+		}
+		done = true;
+	});
+
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&, r]() {
+			for (size_t i = r; done == false || i < urls.size(); i++) {
+				auto read = shared->try_read(urls[i % urls.size()]);
+				if (read.first && (size_t)(read.second & 0xFFFFFFFF) != i % urls.size())
+					wrong_values++;
+				reads++;
+			}
+		});
+	}
+
+	writer.join();
+	for (auto& reader : readers)
+		reader.join();
+
+	VERIFY(wrong_values == 0);
+	VERIFY(reads > 0);
+	VERIFY(shared->entries_count() == (int)urls.size() / 2);
+	for (size_t i = 0; i < urls.size(); i++)
+		VERIFY(shared->try_read(urls[i]) == (i % 2 == 0 ? std::make_pair(true, (int64_t)19 << 32 | (int64_t)i) : std::make_pair(false, (int64_t)0)));
+	shared->unsynchronized().validate();
+}
+
+
+TEST_CASE("speculative reads stay inside the buffer while a writer moves it around", "[trie]") {
+
+	auto shared = std::make_unique<concurrent_trie<trie>>();
+	auto& urls = ravendb_urls();
+	std::atomic<bool> done(false);
+	std::atomic<int> wrong_values(0);
+	std::atomic<int> reads(0);
+
+	// keys of one byte fill up the children of the root through every kind, and back again
+	std::vector<std::string> keys(urls.begin(), urls.end());
+	for (int c = 1; c < 256; c++)
+		keys.push_back(std::string(1, (char)c));
+
+	// every change that moves blocks: writes that split and grow, removes that shrink, compaction steps that
+	// move blocks down, and full defrags that rewrite the whole buffer
+	shared->update([](trie& t) { t.set_compaction_policy(256, 512); });
+	std::thread writer([&]() {
+		for (int round = 0; round < 30 || reads < 300000; round++) {
+			for (size_t i = round % 3; i < keys.size(); i++)
+				shared->write(keys[i], (int64_t)round << 32 | (int64_t)i);
+			for (size_t i = round % 2; i < keys.size(); i += 2)
+				shared->remove(keys[i]);
+			while (shared->update([](trie& t) { return t.defrag_step(64); }) == false) {
+			}
+			if (round % 4 == 0)
+				shared->defrag();
+		}
+		done = true;
+	});
+
+	// the readers go through concurrent_trie, which runs the lookup on whatever the buffer holds at the time,
+	// and only throws the result away after
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&, r]() {
+			for (size_t i = r; done == false; i++) {
+				auto read = shared->try_read(keys[i % keys.size()]);
+				if (read.first && (size_t)(read.second & 0xFFFFFFFF) != i % keys.size())
+					wrong_values++;
+				reads++;
+			}
+		});
+	}
+
+	writer.join();
+	for (auto& reader : readers)
+		reader.join();
+
+	VERIFY(wrong_values == 0);
+	trie::validation_report report;
+	VERIFY(shared->unsynchronized().validate(report));
+}
+
+
+TEST_CASE("trie handle readers get point in time views", "[trie]") {
+
+	trie t;
+	VERIFY(t.write("before", 1) == trie::result::success);
+	auto copy = t.snapshot();
+	VERIFY(t.write("after", 2) == trie::result::success);
+	VERIFY(copy->try_read("before").second == 1);
+	VERIFY(copy->try_read("after").first == false);
+	copy->validate();
+
+	trie_handle<trie> handle;
+	auto urls = ravendb_urls();
+	std::atomic<bool> done(false);
+	std::atomic<int> torn_views(0);
+	std::atomic<int> views(0);
+
+	// every version has the same value for all the urls, so a view that mixes two versions shows up
+	std::thread writer([&]() {
+		for (int version = 1; version <= 50; version++) {
+			handle.update([&](trie& next) {
+				for (auto& url : urls)
+					next.write(url, version);
+				next.defrag();
+			});
+		}
+		done = true;
+	});
+
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&]() {
+			while (done == false) {
+				auto view = handle.snapshot();
+				auto first = view->try_read(urls[0]);
+				for (auto& url : urls) {
+					if (view->try_read(url) != first)
+						torn_views++;
+				}
+				views++;
+			}
+		});
+	}
+
+	writer.join();
+	for (auto& reader : readers)
+		reader.join();
+
+	VERIFY(torn_views == 0);
+	VERIFY(views > 0);
+	{
+		auto view = handle.snapshot();
+		VERIFY(view->entries_count() == (int)urls.size());
+		VERIFY(view->try_read(urls[0]).second == 50);
+
+		// the view keeps the version it has from being deleted
+		VERIFY(handle.write("new", 51) == trie::result::success);
+		VERIFY(view->try_read("new").first == false);
+		VERIFY(handle.retired_count() > 0);
+	}
+	VERIFY(handle.remove("new"));
+	VERIFY(handle.retired_count() == 0);
+	VERIFY(handle.snapshot()->try_read("new").first == false);
+}
+
+
+TEST_CASE("sharded trie takes writes from many threads, and splits full shards", "[trie]") {
+
+	sharded_trie shared(4);
+	const int threads_count = 4;
+	const int keys_per_thread = 20000;
+	std::atomic<int> wrong_reads(0);
+
+	// each thread writes keys of its own, and reads back the ones of the others as they show up
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threads_count; t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0; i < keys_per_thread; i++) {
+				auto key = std::to_string(t) + "/documents/" + std::to_string(i);
+				if (shared.write(key, (int64_t)t * keys_per_thread + i) != trie::result::success)
+					wrong_reads++;
+				if (shared.try_read(key) != std::make_pair(true, (int64_t)t * keys_per_thread + i))
+					wrong_reads++;
+				if (i % 3 == 0 && shared.remove(key) == false)
+					wrong_reads++;
+
+				auto other = (t + 1) % threads_count;
+				auto read = shared.try_read(std::to_string(other) + "/documents/" + std::to_string(i));
+				if (read.first && read.second != (int64_t)other * keys_per_thread + i)
+					wrong_reads++;
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	VERIFY(wrong_reads == 0);
+	VERIFY(shared.shards_count() > 4);
+	VERIFY(shared.entries_count() == (size_t)threads_count * (keys_per_thread - (keys_per_thread + 2) / 3));
+	for (int t = 0; t < threads_count; t++) {
+		for (int i = 0; i < keys_per_thread; i++) {
+			auto expected = i % 3 == 0 ? std::make_pair(false, (int64_t)0) : std::make_pair(true, (int64_t)t * keys_per_thread + i);
+			VERIFY(shared.try_read(std::to_string(t) + "/documents/" + std::to_string(i)) == expected);
+		}
+	}
+	shared.validate();
+}
+
+
+TEST_CASE("instrumented trie counts what its operations do", "[trie]") {
+
+	static_assert(sizeof(trie) == trie::BUFFER_SIZE, "the default instrumentation takes no room");
+
+	auto t = std::make_unique<instrumented_trie>();
+	VERIFY(t->write("k", 1) == trie::result::success);
+	for (int i = 0; i < 10; i++)
+		VERIFY(t->write("k" + std::to_string(i), i) == trie::result::success);
+	VERIFY(t->stats().children_reallocations == 1); // from node4 to node16, on the fifth child
+	VERIFY(t->stats().node_splits == 0);
+
+	VERIFY(t->write("kab", 1) == trie::result::success);
+	VERIFY(t->write("kac", 1) == trie::result::success);
+	VERIFY(t->stats().node_splits == 1);
+	VERIFY(t->stats().write_latency.count == 13);
+
+	VERIFY(t->try_read("k5").first);
+	VERIFY(t->try_read("kac").first);
+	VERIFY(t->try_read("ka").first == false);
+	VERIFY(t->try_read("x").first == false);
+	auto& stats = t->stats();
+	VERIFY(stats.lookups == 4);
+	VERIFY(stats.hits == 2);
+	VERIFY(stats.misses == 2);
+	VERIFY(stats.nodes_visited == 2 + 3 + 2 + 1);
+	VERIFY(stats.max_nodes_visited == 3);
+	VERIFY(stats.read_latency.count == 4);
+	VERIFY(stats.read_latency.percentile(1) == stats.read_latency.max);
+
+	// batched reads count as a lookup for each key
+	std::string_view batch[] = { "k5", "kac", "x" };
+	std::pair<bool, int64_t> results[3];
+	t->try_read_many(batch, 3, results);
+	VERIFY(stats.lookups == 7);
+	VERIFY(stats.hits == 4);
+	VERIFY(stats.misses == 3);
+	VERIFY(stats.read_latency.count == 7);
+
+	// fill the trie, and free half of it, so the writes that follow have to defrag
+	auto urls = ravendb_urls();
+	size_t written = 0;
+	while (written < urls.size() && t->write(urls[written], 1) == trie::result::success)
+		written++;
+	for (size_t i = 0; i < written; i += 2)
+		VERIFY(t->remove(urls[i]));
+	VERIFY(stats.implicit_defrags == 0);
+	size_t again = 0;
+	while (again < urls.size() && t->write(urls[again] + "/again", 1) == trie::result::success)
+		again++;
+	VERIFY(again > written / 2);
+	VERIFY(stats.implicit_defrags > 0);
+	VERIFY(stats.out_of_space >= stats.implicit_defrags);
+	VERIFY(stats.bytes_reclaimed > 0);
+	VERIFY(stats.remove_latency.count == (written + 1) / 2);
+	t->validate();
+
+	t->reset_stats();
+	VERIFY(t->stats().lookups == 0);
+	VERIFY(t->stats().write_latency.count == 0);
+
+	auto data = std::make_unique<char[]>(t->serialized_size());
+	t->serialize(data.get());
+	trie::result result;
+	VERIFY(instrumented_trie::view(data.get(), t->serialized_size(), result) == nullptr && result == trie::result::invalid_format);
+}
+
+
+TEST_CASE("latency histogram buckets are within an eighth of their values", "[trie]") {
+
+	uint64_t values[] = { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 123456, 1ull << 40, (1ull << 40) + 12345, UINT64_MAX };
+	for (auto value : values) {
+		auto bucket = trie_latency_histogram::bucket_of(value);
+		VERIFY(bucket < trie_latency_histogram::BUCKETS);
+		VERIFY(value <= trie_latency_histogram::bucket_upper_bound(bucket));
+		VERIFY(value - value / 8 <= trie_latency_histogram::bucket_upper_bound(bucket) - trie_latency_histogram::bucket_upper_bound(bucket) / 8);
+		if (bucket > 0)
+			VERIFY(value > trie_latency_histogram::bucket_upper_bound(bucket - 1));
+	}
+
+	trie_latency_histogram histogram;
+	for (uint64_t i = 1; i <= 1000; i++)
+		histogram.record(i);
+	VERIFY(histogram.count == 1000);
+	VERIFY(histogram.percentile(0.5) >= 500);
+	VERIFY(histogram.percentile(0.5) <= 500 + 500 / 8);
+	VERIFY(histogram.percentile(0.99) >= 990);
+	VERIFY(histogram.percentile(1) == 1000);
+
+	trie_latency_histogram other;
+	other.record(5000);
+	histogram.merge(other);
+	VERIFY(histogram.count == 1001);
+	VERIFY(histogram.percentile(1) == 5000);
+}
+
+
+TEST_CASE("layout stats account for every byte of the trie", "[trie]") {
+
+	auto check_totals = [](const trie_stats& stats) {
+		VERIFY(stats.header_bytes + stats.key_bytes + stats.padding_bytes + stats.value_bytes + stats.children_bytes +
+			stats.garbage_bytes + stats.unallocated_bytes == trie::BUFFER_SIZE);
+		int keys = 0, nodes = 0, children = 0, arrays = 0;
+		for (int i = 0; i <= UINT8_MAX + 1; i++) {
+			keys += stats.keys_by_depth[i];
+			nodes += stats.nodes_by_fan_out[i];
+			children += i * stats.nodes_by_fan_out[i];
+		}
+		for (auto count : stats.children_arrays_by_kind)
+			arrays += count;
+		VERIFY(keys == stats.keys_count);
+		VERIFY(nodes == stats.nodes_count);
+		VERIFY(children == (nodes > 0 ? nodes - 1 : 0));
+		VERIFY(arrays == nodes - stats.nodes_by_fan_out[0]);
+		VERIFY(stats.value_bytes == stats.keys_count * (int)sizeof(int64_t));
+	};
+
+	trie t;
+	check_totals(t.layout_stats());
+	VERIFY(t.layout_stats().unallocated_bytes + t.layout_stats().header_bytes == trie::BUFFER_SIZE);
+
+	VERIFY(t.write("users/1", 1) == trie::result::success);
+	VERIFY(t.write("users/2", 2) == trie::result::success);
+	VERIFY(t.write("users/22", 3) == trie::result::success);
+	auto stats = t.layout_stats();
+	check_totals(stats);
+	VERIFY(stats.keys_count == 3);
+	VERIFY(stats.nodes_count == 4); // "users/" with "1" and "2" below it, and "2" below that
+	VERIFY(stats.keys_by_depth[1] == 2);
+	VERIFY(stats.keys_by_depth[2] == 1);
+	VERIFY(stats.nodes_by_fan_out[0] == 2);
+	VERIFY(stats.nodes_by_fan_out[1] == 1);
+	VERIFY(stats.nodes_by_fan_out[2] == 1);
+	VERIFY(stats.children_arrays_by_kind[0] == 2);
+	VERIFY(stats.key_bytes == 6 + 1 + 1 + 1);
+	VERIFY(stats.garbage_bytes == t.wasted_space());
+	VERIFY(stats.padding_bytes > 0); // keys are aligned to 8 bytes
+
+	auto urls = ravendb_urls();
+	for (size_t i = 0; i < urls.size(); i++) {
+		if (t.write(urls[i], (int64_t)i) != trie::result::success)
+			break;
+	}
+	check_totals(t.layout_stats());
+	for (size_t i = 0; i < urls.size(); i += 3)
+		t.remove(urls[i]);
+	stats = t.layout_stats();
+	check_totals(stats);
+	VERIFY(stats.keys_count == t.entries_count());
+	VERIFY(stats.garbage_bytes == t.wasted_space());
+	VERIFY(stats.garbage_bytes > 0);
+
+	t.defrag();
+	VERIFY(t.layout_stats().garbage_bytes == 0);
+	check_totals(t.layout_stats());
+}
+
+
+TEST_CASE("sharded trie splits a single shard as many times as it fills up", "[trie]") {
+
+	sharded_trie single(1);
+	const int count = 20000;
+	for (int i = 0; i < count; i++)
+		VERIFY(single.write("documents/" + std::to_string(i), i) == trie::result::success);
+
+	VERIFY(single.shards_count() > 4); // far more than one page holds
+	VERIFY(single.entries_count() == (size_t)count);
+	for (int i = 0; i < count; i++)
+		VERIFY(single.try_read("documents/" + std::to_string(i)) == std::make_pair(true, (int64_t)i));
+	single.validate();
+}
+
+
+TEST_CASE("sharded trie readers stay inside their shards while the shards split and defrag", "[trie]") {
+
+	sharded_trie shared(1);
+	const int count = 30000;
+	std::vector<std::string> keys;
+	for (int i = 0; i < count; i++)
+		keys.push_back("documents/" + std::to_string(i));
+	std::atomic<bool> done(false);
+	std::atomic<int> wrong_values(0);
+	std::atomic<int> reads(0);
+
+	// The single root shard fills up and splits over and over. The removes, and the entries a split moves
+	// away, leave garbage behind, so the writes that run out of room defrag the shard before they split it.
+	std::thread writer([&]() {
+		for (int i = 0; i < count; i++) {
+			if (shared.write(keys[i], i) != trie::result::success)
+				wrong_values++;
+			if (i % 4 == 3)
+				shared.remove(keys[i - 2]);
+		}
+		done = true;
+	});
+
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 2; r++) {
+		readers.emplace_back([&, r]() {
+			std::mt19937 random(r);
+			while (done == false) {
+				auto i = (int)(random() % count);
+				auto read = shared.try_read(keys[i]);
+				if (read.first && read.second != i)
+					wrong_values++;
+				reads++;
+			}
+		});
+	}
+
+	writer.join();
+	for (auto& reader : readers)
+		reader.join();
+
+	VERIFY(wrong_values == 0);
+	VERIFY(reads > 0);
+	VERIFY(shared.shards_count() > 4);
+	for (int i = 0; i < count; i++)
+		VERIFY(shared.try_read(keys[i]) == (i % 4 == 1 ? std::make_pair(false, (int64_t)0) : std::make_pair(true, (int64_t)i)));
+	shared.validate();
+}
@@ -1,270 +1,593 @@
 #include "stdafx.h"
 #include "trie.h"
 #include "trie.impl.h"
+#include "trie.intrinsics.h"
 
-trie::trie() {
-	auto trie_header = (trie_header_info*)_buffer;
+template<typename OffsetT>
+void reset_trie_header(trie_header_info<OffsetT>* trie_header) {
 	trie_header->items_count = 0;
-	trie_header->next_alloc = sizeof(trie_header_info);
-	trie_header->used_size = sizeof(trie_header_info);
+	trie_header->next_alloc = sizeof(trie_header_info<OffsetT>);
+	trie_header->used_size = sizeof(trie_header_info<OffsetT>);
+	trie_header->root_offset = 0;
+	trie_header->compaction_cursor = sizeof(trie_header_info<OffsetT>);
+	std::fill(std::begin(trie_header->free_lists), std::end(trie_header->free_lists), (OffsetT)0);
 }
 
-void write_trie_node(char* base, node_header_info* node_header, short offset, const std::string&key, 
-	int position_in_key, long val) {
+// tells the instrumentation how long the operation took once it returns, whichever way it does
+template<typename Instrumentation>
+struct timed_operation {
+	const Instrumentation& instrumentation;
+	trie_operation operation;
+	typename Instrumentation::timing start;
 
-	node_header->children_offset = 0;
-	node_header->key_offset = offset + sizeof(node_header_info);
-	node_header->key_size = (short)(key.length() - position_in_key);
-    short aligned_key_size = (short)(node_header->key_size + 8 - (node_header->key_size % 8));
-	node_header->value_offset = node_header->key_offset + aligned_key_size;
+	~timed_operation() {
+		instrumentation.on_finished(operation, start);
+	}
+};
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::basic_trie() {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	reset_trie_header(trie_header);
+	trie_header->format = trie_format<OffsetT>();
+	trie_header->checksum = 0;
+	trie_header->compaction_threshold = 0;
+	trie_header->compaction_budget = 0;
+}
 
-	auto bound_checked_buffer = stdext::make_checked_array_iterator(
-		base + node_header->key_offset,
-		trie::BUFFER_SIZE - node_header->key_offset);
+template<typename OffsetT>
+void unlink_free_block(char* base, trie_header_info<OffsetT>* trie_header, block_header_info<OffsetT>* block) {
+	if (block_size(block) < min_listed_block_size<OffsetT>())
+		return;
 
-	std::copy(key.begin() + position_in_key, key.end(), bound_checked_buffer);
+	auto links = get_free_links(block);
+	if (links->prev != 0)
+		get_free_links((block_header_info<OffsetT>*)(base + links->prev))->next = links->next;
+	else
+		trie_header->free_lists[free_list_index(block_size(block))] = links->next;
 
-	*(long*)(base + node_header->key_offset + aligned_key_size) = val;
+	if (links->next != 0)
+		get_free_links((block_header_info<OffsetT>*)(base + links->next))->prev = links->prev;
 }
 
-node_header_info* find_child(char* base, char first_char, short* children_offsets, short number_of_children) {
-
-	auto match = std::lower_bound(children_offsets, children_offsets + number_of_children, 0,
-		[base, first_char](const short x_offset, const short _) {
-		auto node = (node_header_info*)(base + x_offset);
-		auto node_first_char = *(base + node->key_offset);
-		return node_first_char > first_char;
-	});
+// Marks the space as a free block, and puts it on the free list for its size, if it is large enough.
+template<typename OffsetT>
+void add_free_block(char* base, trie_header_info<OffsetT>* trie_header, block_header_info<OffsetT>* block, OffsetT size) {
+	block->size_and_kind = size; // free_block is 0
+	block->owner = 0;
+	if (size < min_listed_block_size<OffsetT>())
+		return;
+
+	auto& head = trie_header->free_lists[free_list_index(size)];
+	auto links = get_free_links(block);
+	links->next = head;
+	links->prev = 0;
+	if (head != 0)
+		get_free_links((block_header_info<OffsetT>*)(base + head))->prev = offset_of<OffsetT>(base, block);
+	head = offset_of<OffsetT>(base, block);
+}
 
-	auto node = (node_header_info*)(base + *match);
-	auto node_first_char = *(base + node->key_offset);
-	if (node_first_char == first_char)
-		return node;
+// Returns a free block that has room for size bytes, or nullptr. Every block in a larger size class
+// fits, so only the list for the size itself needs to be searched.
+template<typename OffsetT>
+block_header_info<OffsetT>* find_free_block(char* base, trie_header_info<OffsetT>* trie_header, int size) {
+	auto index = free_list_index(size);
+	for (auto offset = trie_header->free_lists[index]; offset != 0;) {
+		auto block = (block_header_info<OffsetT>*)(base + offset);
+		if (block_size(block) >= size)
+			return block;
+		offset = get_free_links(block)->next;
+	}
 
+	for (index++; index < FREE_LISTS_COUNT; index++) {
+		if (trie_header->free_lists[index] != 0)
+			return (block_header_info<OffsetT>*)(base + trie_header->free_lists[index]);
+	}
 	return nullptr;
 }
 
-MatchResult get_failed_result(char* base, node_header_info* current, const std::string& key, int& position_in_key) {
+// Allocates a block, from a hole left by freed blocks if there is one that fits, or at the end of the trie.
+// Returns the offset of its payload, the caller is responsible for making sure that there is room for it.
+template<typename OffsetT>
+OffsetT allocate_block(char* base, trie_header_info<OffsetT>* trie_header, int payload_size, unsigned char kind, OffsetT owner) {
+	auto size = block_size_for<OffsetT>(payload_size);
+	auto block = find_free_block(base, trie_header, size);
+	if (block != nullptr) {
+		unlink_free_block(base, trie_header, block);
+		auto rest = (OffsetT)(block_size(block) - size);
+		if (rest > 0)
+			add_free_block(base, trie_header, (block_header_info<OffsetT>*)((char*)block + size), rest);
+	}
+	else {
+		block = (block_header_info<OffsetT>*)(base + trie_header->next_alloc);
+		trie_header->next_alloc += size;
+	}
 
-	auto safe_key_it = stdext::make_checked_array_iterator(key.c_str(), key.length());
+	block->size_and_kind = (OffsetT)(size | kind);
+	block->owner = owner;
+	trie_header->used_size += size;
+	return offset_of<OffsetT>(base, block + 1);
+}
 
-	auto size_to_compare = std::min(current->key_size, (short)(key.length() - position_in_key));
-	auto result = std::mismatch(base + current->key_offset, base + current->key_offset + size_to_compare, safe_key_it + position_in_key);
-	auto first_diff = (short)(result.second.base() - (key.c_str() + position_in_key));
+template<typename OffsetT>
+void free_space(char* base, trie_header_info<OffsetT>* trie_header, block_header_info<OffsetT>* block, OffsetT size) {
+	trie_header->used_size -= size;
+
+	// merge with the block after it, if that one is free too
+	auto next = offset_of<OffsetT>(base, block) + size;
+	if (next < trie_header->next_alloc && block_kind((block_header_info<OffsetT>*)(base + next)) == free_block) {
+		unlink_free_block(base, trie_header, (block_header_info<OffsetT>*)(base + next));
+		size += block_size((block_header_info<OffsetT>*)(base + next));
+		if (trie_header->compaction_cursor == next)
+			trie_header->compaction_cursor = offset_of<OffsetT>(base, block);
+	}
 
-	position_in_key += first_diff;
+	if (offset_of<OffsetT>(base, block) + size == trie_header->next_alloc) {
+		trie_header->next_alloc = offset_of<OffsetT>(base, block); // at the end of the trie, nothing to keep track of
+		trie_header->compaction_cursor = std::min(trie_header->compaction_cursor, trie_header->next_alloc);
+		return;
+	}
 
-	return MatchResult{ false, current, first_diff };// not a match
+	add_free_block(base, trie_header, block, size);
 }
 
-MatchResult find_match(char* base, node_header_info* current, const std::string& key, int& position_in_key) {
+template<typename OffsetT>
+void release_block(char* base, trie_header_info<OffsetT>* trie_header, OffsetT offset) {
+	auto block = get_block<OffsetT>(base, offset);
+	free_space(base, trie_header, block, block_size(block));
+}
 
-	auto reamining_match = (key.length() - position_in_key);
-	if (reamining_match == 0)
-		return MatchResult{ true, current, current->key_size };
+// Gives back the end of a block that is no longer needed, such as the value at the end of a node record.
+template<typename OffsetT>
+void shrink_block(char* base, trie_header_info<OffsetT>* trie_header, OffsetT offset, int payload_size) {
+	auto block = get_block<OffsetT>(base, offset);
+	auto size = block_size_for<OffsetT>(payload_size);
+	auto unused = (OffsetT)(block_size(block) - size);
+	if (unused == 0)
+		return;
+
+	block->size_and_kind = (OffsetT)(size | block_kind(block));
+	free_space(base, trie_header, (block_header_info<OffsetT>*)((char*)block + size), unused);
+}
 
-	if ((size_t)current->key_size > reamining_match) {
-		return get_failed_result(base, current, key, position_in_key);// current key is larger than remaining key
+// Moves a live block to a lower offset, then points its owner at the new location, and fixes
+// the offsets inside it and the owners of the blocks it points to.
+template<typename OffsetT>
+void move_block(char* base, OffsetT from, OffsetT to) {
+	auto size = block_size((block_header_info<OffsetT>*)(base + from));
+	std::memmove(base + to, base + from, size);
+
+	auto block = (block_header_info<OffsetT>*)(base + to);
+	auto offset = offset_of<OffsetT>(base, block + 1);
+	auto delta = (OffsetT)(to - from);
+	*(OffsetT*)(base + block->owner) = offset;
+
+	switch (block_kind(block)) {
+	case node_block: {
+		auto node = (node_header_info<OffsetT>*)(base + offset);
+		node->key_offset += delta;
+		if (node->value_offset != 0) {
+			if (node->value_offset >= from && node->value_offset < from + size)
+				node->value_offset += delta; // the value was allocated with the node and moved with it
+			else
+				get_block<OffsetT>(base, node->value_offset)->owner = offset_of<OffsetT>(base, &node->value_offset);
+		}
+		if (node->children_offset != 0)
+			get_block<OffsetT>(base, node->children_offset)->owner = offset_of<OffsetT>(base, &node->children_offset);
+		break;
+	}
+	case children_block:
+		update_children_owners(base, get_children<OffsetT>(base, offset));
+		break;
 	}
+}
+
+template<typename OffsetT>
+void link_child(char* base, children_header_info<OffsetT>* children, unsigned char first_byte, OffsetT child_offset) {
+	add_child(children, first_byte, child_offset);
+	if (children->kind == node4 || children->kind == node16)
+		update_children_owners(base, children); // the children after it were shifted
+	else
+		get_block<OffsetT>(base, child_offset)->owner = offset_of<OffsetT>(base, child_slot(children, first_byte));
+}
+
+template<typename OffsetT>
+void unlink_child(char* base, children_header_info<OffsetT>* children, unsigned char first_byte) {
+	remove_child(children, first_byte);
+	if (children->kind == node4 || children->kind == node16)
+		update_children_owners(base, children);
+}
+
+// Moves the children to a new array of the given kind, the caller checks that there is room for it.
+template<typename OffsetT>
+void reallocate_children(char* base, trie_header_info<OffsetT>* trie_header, node_header_info<OffsetT>* parent, unsigned char kind) {
+	auto old_children = get_children<OffsetT>(base, parent->children_offset);
+	auto children_offset = allocate_block(base, trie_header, children_size<OffsetT>(kind), children_block,
+		offset_of<OffsetT>(base, &parent->children_offset));
+	auto children = get_children<OffsetT>(base, children_offset);
+	init_children(children, kind);
+	for_each_child(old_children, [children](unsigned char first_byte, OffsetT& offset) {
+		add_child(children, first_byte, offset);
+	});
+	update_children_owners(base, children);
+
+	release_block(base, trie_header, parent->children_offset);
+	parent->children_offset = children_offset;
+}
 
-	if (std::memcmp(base + current->key_offset, key.c_str() + position_in_key, current->key_size) != 0) {
+template<typename OffsetT, typename ValueT>
+void write_trie_node(char* base, node_header_info<OffsetT>* node_header, OffsetT offset, std::string_view key,
+	int position_in_key, ValueT val) {
 
-		return get_failed_result(base, current, key, position_in_key);
+	node_header->children_offset = 0;
+	node_header->subtree_count = 1;
+	node_header->key_offset = offset + sizeof(node_header_info<OffsetT>);
+	node_header->key_size = (OffsetT)(key.length() - position_in_key);
+    OffsetT aligned_key_size = (OffsetT)(node_header->key_size + 8 - (node_header->key_size % 8));
+	node_header->value_offset = node_header->key_offset + aligned_key_size;
+
+	// has_enough_size made sure the node fits, so the key can't run past the end of the page
+	std::memcpy(base + node_header->key_offset, key.data() + position_in_key, node_header->key_size);
+
+	write_value(base, node_header->key_offset + aligned_key_size, val);
+}
+
+template<typename OffsetT>
+node_header_info<OffsetT>* find_child(char* base, unsigned char first_byte, OffsetT children_offset) {
+
+	auto children = get_children<OffsetT>(base, children_offset);
+	OffsetT child_offset;
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		// the offsets come right after the first bytes, so the whole array can be read
+		auto first_bytes = sorted_first_bytes(children);
+		auto readable = children_size<OffsetT>(children->kind) - (int)sizeof(children_header_info<OffsetT>);
+		auto index = find_byte(first_bytes, children->count, readable, first_byte);
+		if (index < 0)
+			return nullptr;
+		child_offset = sorted_offsets(children)[index];
+		break;
+	}
+	case node48: {
+		auto slot = indexed_slots(children)[first_byte];
+		if (slot == 0)
+			return nullptr;
+		child_offset = indexed_offsets(children)[slot - 1];
+		break;
 	}
-	position_in_key += current->key_size;
-	if (position_in_key == key.length()) { // found match
-		return MatchResult{ true, current, current->key_size };
+	default:
+		child_offset = direct_offsets(children)[first_byte];
+		if (child_offset == 0)
+			return nullptr;
+		break;
 	}
+
+	return (node_header_info<OffsetT>*)(base + child_offset);
+}
+
+// Compares current's key fragment with the key, moving position_in_key past the part that matched.
+// Returns true if the lookup goes on with one of current's children, otherwise result has the outcome.
+template<typename OffsetT>
+bool match_fragment(char* base, node_header_info<OffsetT>* current, std::string_view key, int& position_in_key, MatchResult<OffsetT>& result) {
+
+	auto size_to_compare = std::min((int)current->key_size, (int)key.length() - position_in_key);
+	auto matched = common_prefix_length(base + current->key_offset, key.data() + position_in_key, size_to_compare);
+	position_in_key += matched;
+
+	if (matched != current->key_size) {
+		result = MatchResult<OffsetT>{ false, current, (short)matched }; // not a match, or the key ends in the middle of this node
+		return false;
+	}
+
+	if (position_in_key == (int)key.length()) {
+		result = MatchResult<OffsetT>{ true, current, (short)current->key_size }; // found match
+		return false;
+	}
+
 	if (current->children_offset == 0) {
-		return MatchResult{ false, current, current->key_size }; // no children, can go forward
+		result = MatchResult<OffsetT>{ false, current, (short)current->key_size }; // no children, can't go forward
+		return false;
 	}
 
-	auto num_of_children = *(char*)(base + current->children_offset);
-	auto children_offsets = (short*)(base + current->children_offset + sizeof(char));
+	return true;
+}
+
+// Walks down from current for as long as the key matches, comparing each node's key fragment in a single pass.
+// When depth is given, it counts the nodes visited, and when path is given too, it records them, and must have
+// room for MAX_TRIE_DEPTH entries.
+template<typename OffsetT>
+MatchResult<OffsetT> find_match(char* base, node_header_info<OffsetT>* current, std::string_view key, int& position_in_key,
+	node_header_info<OffsetT>** path = nullptr, int* depth = nullptr) {
+
+	MatchResult<OffsetT> result;
+	while (true) {
+		if (path != nullptr)
+			path[*depth] = current;
+		if (depth != nullptr)
+			(*depth)++;
 
-	auto child = find_child(base, key[position_in_key], children_offsets, num_of_children);
-	if (child != nullptr)
-		return find_match(base, child, key, position_in_key);
+		if (match_fragment(base, current, key, position_in_key, result) == false)
+			return result;
+
+		auto child = find_child(base, (unsigned char)key[position_in_key], current->children_offset);
+		if (child == nullptr)
+			return MatchResult<OffsetT>{ false, current, (short)current->key_size }; // no matching children, can't go forward
+
+		current = child;
+	}
+}
 
-	return MatchResult{ false, current, current->key_size }; // no matching children, can't go forward
+// how far the allocations can go, next_alloc must still fit in an offset once it gets there
+template<size_t PageSize, typename OffsetT>
+constexpr int allocation_limit() {
+	return (int)std::min<size_t>(PageSize, (size_t)std::numeric_limits<OffsetT>::max());
 }
 
-bool has_enough_size(trie_header_info* trie_header, short required_size, trie::result& result) {
+// There is room if the end of the trie or a single hole has room for all of the required size, since a hole
+// that a first allocation is carved from still has room for the next ones.
+template<size_t PageSize, typename OffsetT>
+bool has_enough_size(char* base, trie_header_info<OffsetT>* trie_header, int required_size, trie_base::result& result) {
 
-	if (trie_header->used_size + required_size > trie::BUFFER_SIZE ||
-		trie_header->used_size + required_size > INT16_MAX)
+	if (trie_header->used_size + required_size > allocation_limit<PageSize, OffsetT>())
 	{
-		result = trie::result::not_enough_space;
+		result = trie_base::result::not_enough_space;
 		return false;
 	}
 
-	if (trie_header->next_alloc + required_size > trie::BUFFER_SIZE || 
-		trie_header->next_alloc + required_size > INT16_MAX)
+	if (trie_header->next_alloc + required_size > allocation_limit<PageSize, OffsetT>() &&
+		find_free_block(base, trie_header, required_size) == nullptr)
 	{
-		result = trie::result::defrag_required;
+		result = trie_base::result::defrag_required;
 		return false;
 	}
 
 	return true;
 }
 
-trie::result append_child_node(char* base, short required_size, trie_header_info* trie_header, 
-	node_header_info* parent, const std::string& key,	int position_in_key, long val) {
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result append_child_node(char* base, int required_size, trie_header_info<OffsetT>* trie_header,
+	node_header_info<OffsetT>* parent, std::string_view key,	int position_in_key, ValueT val, const Instrumentation& instrumentation) {
 
-	auto old_number_of_children =
-		parent->children_offset == 0 ? 0 : (*(base + parent->children_offset));
+	auto old_children = parent->children_offset == 0 ? nullptr : get_children<OffsetT>(base, parent->children_offset);
 
-	required_size += (short)(
-		sizeof(char) + // length
-		sizeof(short) + // new child
-		(old_number_of_children * sizeof(short)));
+	// grow the children array to the next kind if there is no room for the new child
+	int children_required_size = 0;
+	unsigned char kind = node4;
+	if (old_children == nullptr) {
+		children_required_size = block_size_for<OffsetT>(children_size<OffsetT>(kind));
+	}
+	else if (old_children->count == children_capacity(old_children->kind)) {
+		kind = (unsigned char)(old_children->kind + 1);
+		children_required_size = block_size_for<OffsetT>(children_size<OffsetT>(kind));
+	}
 
-	trie::result fail;
-	if (has_enough_size(trie_header, required_size, fail) == false)
+	trie_base::result fail;
+	if (has_enough_size<PageSize>(base, trie_header, block_size_for<OffsetT>(required_size) + children_required_size, fail) == false) {
+		instrumentation.on_out_of_space();
 		return fail;
+	}
 
-	if (trie_header->items_count == UINT16_MAX)
-		return trie::result::max_number_of_items_stored;
+	if (trie_header->items_count == std::numeric_limits<OffsetT>::max())
+		return trie_base::result::max_number_of_items_stored;
 
 	trie_header->items_count++;
 
-	auto old_children_offset = parent->children_offset;
-
-	parent->children_offset = trie_header->next_alloc;
-	trie_header->next_alloc += required_size;
-	trie_header->used_size += required_size;
-	// record the wasted space for the old children array
-	trie_header->used_size -= (short)(sizeof(char) + sizeof(short) * old_number_of_children);
-
-
-	auto children_offsets = ((short*)(base + parent->children_offset + sizeof(char)));
-	children_offsets[0] = (short)(parent->children_offset
-		+ sizeof(char) // length
-		+ sizeof(short) * (old_number_of_children + 1));// offset of 1st child
-
-	auto child = (node_header_info*)(base + children_offsets[0]);
-	write_trie_node(base, child, children_offsets[0], key, position_in_key, val);
-
-	*(char*)(base + parent->children_offset) = 1 + old_number_of_children;
-	std::memcpy(
-		(char*)children_offsets + sizeof(short), // skip the first value that we just entered
-		(base + old_children_offset + sizeof(char)),
-		sizeof(short) * old_number_of_children);
-
-	// now sort the children by the first char 
-	std::sort(children_offsets, children_offsets + old_number_of_children + 1,
-		[base](short x_offset, short y_offset) {
-		auto x_node = (node_header_info*)(base + x_offset);
-		auto y_node = (node_header_info*)(base + y_offset);
-		auto x_ch = *(base + x_node->key_offset);
-		auto y_ch = *(base + y_node->key_offset);
-		return x_ch > y_ch;
-	});
+	auto child_offset = allocate_block(base, trie_header, required_size, node_block, (OffsetT)0);
+	write_trie_node(base, (node_header_info<OffsetT>*)(base + child_offset), child_offset, key, position_in_key, val);
+
+	if (old_children == nullptr) {
+		parent->children_offset = allocate_block(base, trie_header, children_size<OffsetT>(kind), children_block,
+			offset_of<OffsetT>(base, &parent->children_offset));
+		init_children(get_children<OffsetT>(base, parent->children_offset), kind);
+	}
+	else if (children_required_size != 0) {
+		reallocate_children(base, trie_header, parent, kind);
+		instrumentation.on_children_reallocated();
+	}
+
+	link_child(base, get_children<OffsetT>(base, parent->children_offset), (unsigned char)key[position_in_key], child_offset);
+
+	return trie_base::result::success;
+}
+
+template<size_t PageSize, typename OffsetT>
+void remove_child_node(char* base, trie_header_info<OffsetT>* trie_header, node_header_info<OffsetT>* parent, unsigned char first_byte) {
+
+	auto children = get_children<OffsetT>(base, parent->children_offset);
+	unlink_child(base, children, first_byte);
+
+	if (children->count == 0) {
+		release_block(base, trie_header, parent->children_offset);
+		parent->children_offset = 0;
+		return;
+	}
 
-	return trie::result::success;
+	auto kind = shrunk_children_kind(children->kind, children->count);
+	trie_base::result fail;
+	if (kind == children->kind ||
+		has_enough_size<PageSize>(base, trie_header, block_size_for<OffsetT>(children_size<OffsetT>(kind)), fail) == false)
+		return; // no need to shrink, or no room to do so right now, defrag will pick the right size
+
+	reallocate_children(base, trie_header, parent, kind);
 }
 
-int trie::entries_count() {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+int basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::entries_count() const {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
 	return trie_header->items_count;
 }
 
-int trie::available_space_before_defrag() {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+int basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::available_space_before_defrag() const {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
 	return BUFFER_SIZE - trie_header->next_alloc;
 }
 
-int trie::wasted_space() {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+int basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::wasted_space() const {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
 	return trie_header->next_alloc - trie_header->used_size;
 }
 
-trie::result trie::add_node(trie_header_info* trie_header, node_header_info* start, short required_size,
-	const std::string& key, int position_in_key, long val) {
+// every node on the way to a new entry has one more entry below it
+template<typename OffsetT>
+void count_new_entry(node_header_info<OffsetT>** path, int depth) {
+	for (int i = 0; i < depth; i++)
+		path[i]->subtree_count++;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::add_node(trie_header_info<OffsetT>* trie_header, node_header_info<OffsetT>* start,
+	int required_size, std::string_view key, int position_in_key, ValueT val) {
 
-	trie::result fail;
-	auto match = find_match(_buffer, start, key, position_in_key);
+	result fail;
+	node_header_info<OffsetT>* path[MAX_TRIE_DEPTH];
+	int depth = 0;
+	auto match = find_match(_buffer, start, key, position_in_key, path, &depth);
 	if (match.success) { // overwrite
 		if (match.current->value_offset == 0) {
-			trie_header->items_count++; // an intermediary node now has a value, need to add it
-			if (has_enough_size(trie_header, sizeof(long), fail) == false)
+			if (trie_header->items_count == std::numeric_limits<OffsetT>::max())
+				return result::max_number_of_items_stored;
+			if (has_enough_size<PageSize>(_buffer, trie_header, block_size_for<OffsetT>(sizeof(ValueT)), fail) == false) {
+				this->on_out_of_space();
 				return fail;
-			match.current->value_offset = trie_header->next_alloc;
-			trie_header->next_alloc += sizeof(long);
-			trie_header->used_size += sizeof(long);
+			}
+			trie_header->items_count++; // an intermediary node now has a value, need to add it
+			match.current->value_offset = allocate_block(_buffer, trie_header, sizeof(ValueT), value_block,
+				offset_of<OffsetT>(_buffer, &match.current->value_offset));
+			count_new_entry(path, depth);
 		}
 
-		*(long*)(_buffer + match.current->value_offset) = val;
+		write_value(_buffer, match.current->value_offset, val);
 
-		return trie::result::success;
+		return result::success;
 	}
 
+	// every way on from here adds an entry
+	if (trie_header->items_count == std::numeric_limits<OffsetT>::max())
+		return result::max_number_of_items_stored;
+
 	if (match.position_in_current_node != match.current->key_size) {
-		// need to split the current node
+		// Need to split the current node. The rest of its key goes to a new node, which takes over its value
+		// and children, and the current node gives back what it no longer needs. If the key ends right at
+		// the split, the value gets a block of its own, otherwise the new child is appended after the split.
+		// Room is checked for all of it at once, since the space the current node gives back makes a hole
+		// that a check after the split could find too small, and the trie would be left half written.
+		auto current = match.current;
+		auto current_offset = offset_of<OffsetT>(_buffer, current);
+		bool key_ends_at_split = position_in_key == (int)key.length();
+		bool value_in_node = current->value_offset != 0 && inside_block<OffsetT>(_buffer, current_offset, current->value_offset);
+		OffsetT split_key_size = current->key_size - match.position_in_current_node;
+		int split_node_size = sizeof(node_header_info<OffsetT>) + split_key_size + (value_in_node ? sizeof(ValueT) : 0);
+
+		int size = block_size_for<OffsetT>(split_node_size) +
+			block_size_for<OffsetT>(children_size<OffsetT>(node4)) +
+			(key_ends_at_split ? block_size_for<OffsetT>(sizeof(ValueT)) : block_size_for<OffsetT>(required_size));
+
+		if (has_enough_size<PageSize>(_buffer, trie_header, size, fail) == false) {
+			this->on_out_of_space();
+			return fail;
+		}
+		this->on_node_split();
 
-		short size = sizeof(node_header_info) +
-			sizeof(char) + // children legnth (1)
-			sizeof(short) + // child offset
-			sizeof(long); // holder for value
+		auto split_offset = allocate_block(_buffer, trie_header, split_node_size, node_block, (OffsetT)0);
+		auto split_node = (node_header_info<OffsetT>*)(_buffer + split_offset);
 
-		if (has_enough_size(trie_header, size, fail) == false)
-			return fail;
+		split_node->key_offset = split_offset + sizeof(node_header_info<OffsetT>);
+		split_node->key_size = split_key_size;
+		split_node->subtree_count = current->subtree_count;
+		std::memcpy(_buffer + split_node->key_offset, _buffer + current->key_offset + match.position_in_current_node, split_key_size);
 
-		auto split_node = (node_header_info*)(_buffer + trie_header->next_alloc);
+		split_node->value_offset = current->value_offset;
+		if (value_in_node) {
+			split_node->value_offset = split_node->key_offset + split_key_size;
+			std::memcpy(_buffer + split_node->value_offset, _buffer + current->value_offset, sizeof(ValueT));
+		}
+		else if (current->value_offset != 0) {
+			get_block<OffsetT>(_buffer, current->value_offset)->owner = offset_of<OffsetT>(_buffer, &split_node->value_offset);
+		}
 
-		split_node->value_offset = match.current->value_offset;
-		split_node->key_size = (match.current->key_size - match.position_in_current_node);
-		split_node->key_offset = match.current->key_offset + match.position_in_current_node;
-		match.current->value_offset = 0;
-		match.current->key_size = match.position_in_current_node;
-		split_node->children_offset = match.current->children_offset;
-		match.current->children_offset = trie_header->next_alloc + sizeof(node_header_info);
-		*(_buffer + match.current->children_offset) = 1;
-		*(short*)(_buffer + match.current->children_offset + 1) = trie_header->next_alloc;
+		split_node->children_offset = current->children_offset;
+		if (current->children_offset != 0)
+			get_block<OffsetT>(_buffer, current->children_offset)->owner = offset_of<OffsetT>(_buffer, &split_node->children_offset);
 
-		trie_header->next_alloc += size;
-		trie_header->used_size += size;
+		current->value_offset = 0;
+		current->key_size = match.position_in_current_node;
+		current->children_offset = allocate_block(_buffer, trie_header, children_size<OffsetT>(node4), children_block,
+			offset_of<OffsetT>(_buffer, &current->children_offset));
+		auto children = get_children<OffsetT>(_buffer, current->children_offset);
+		init_children(children, node4);
+		link_child(_buffer, children, *(unsigned char*)(_buffer + split_node->key_offset), split_offset);
+		shrink_block(_buffer, trie_header, current_offset, sizeof(node_header_info<OffsetT>) + current->key_size);
 
-		return add_node(trie_header, match.current, required_size, key, position_in_key - match.position_in_current_node, val);
+		if (key_ends_at_split) {
+			trie_header->items_count++;
+			current->value_offset = allocate_block(_buffer, trie_header, sizeof(ValueT), value_block,
+				offset_of<OffsetT>(_buffer, &current->value_offset));
+			write_value(_buffer, current->value_offset, val);
+			count_new_entry(path, depth);
+			return result::success;
+		}
 	}
-	return append_child_node(_buffer, required_size, trie_header, match.current, key, position_in_key, val);
+
+	auto result = append_child_node<PageSize>(_buffer, required_size, trie_header, match.current, key, position_in_key, val, *this);
+	if (result == result::success)
+		count_new_entry(path, depth);
+	return result;
 }
 
-trie::result trie::write(const std::string& key, long val) {
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::write(std::string_view key, ValueT val) {
+	timed_operation<Instrumentation> timed{ *this, trie_operation::write, this->start_timing() };
 	if (key.length() > UINT8_MAX)
-		return trie::result::key_too_large;
-    
-    short aligned_key_size = (short)(key.length() + 8 - (key.length() % 8));
-	short required_size = (short)aligned_key_size + sizeof(val) + sizeof(node_header_info);
+		return result::key_too_large;
 
-	auto trie_header = (trie_header_info*)_buffer;
+    int aligned_key_size = (int)(key.length() + 8 - (key.length() % 8));
+	int required_size = aligned_key_size + sizeof(val) + sizeof(node_header_info<OffsetT>);
 
-	trie::result fail;
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
 
-	if (has_enough_size(trie_header, required_size, fail) == false)
+	if (trie_header->compaction_threshold != 0 && wasted_space() >= trie_header->compaction_threshold) {
+		auto wasted = wasted_space();
+		defrag_step(trie_header->compaction_budget);
+		this->on_compaction_step(wasted - wasted_space());
+	}
+
+	result fail;
+
+	if (has_enough_size<PageSize>(_buffer, trie_header, block_size_for<OffsetT>(required_size), fail) == false)
 	{
+		this->on_out_of_space();
+		auto wasted = wasted_space();
 		defrag();
-		if (has_enough_size(trie_header, required_size, fail) == false)
+		this->on_defrag(wasted);
+		if (has_enough_size<PageSize>(_buffer, trie_header, block_size_for<OffsetT>(required_size), fail) == false) {
+			this->on_out_of_space();
 			return fail;
+		}
 	}
 
 	if (trie_header->items_count == 0) {
-		// new trie
+		// new trie, whatever was left by removed entries is gone
+		reset_trie_header(trie_header);
 		trie_header->items_count = 1;
-		auto offset = trie_header->next_alloc = sizeof(trie_header_info); // ensures that the first node is always in the beginning
-		auto node_header = (node_header_info*)(_buffer + offset);
-		trie_header->next_alloc += (short)required_size;
-		trie_header->used_size += (short)required_size;
+		trie_header->root_offset = allocate_block(_buffer, trie_header, required_size, node_block,
+			offset_of<OffsetT>(_buffer, &trie_header->root_offset));
 
-		write_trie_node(_buffer, node_header, offset, key, 0, val);
+		write_trie_node(_buffer, get_root<OffsetT>(_buffer), trie_header->root_offset, key, 0, val);
 
-		return trie::result::success;
+		return result::success;
 	}
-	auto start = (node_header_info*)(_buffer + sizeof(trie_header_info));
-	
+	auto start = get_root<OffsetT>(_buffer);
+
+	// add_node checks for all the room it needs before it changes anything, and once the trie is compact every
+	// byte that isn't used is at its end, so the second try either fits or has not_enough_space
 	auto result = add_node(trie_header, start, required_size, key, 0, val);
-	if (result == trie::result::defrag_required) {
+	if (result == result::defrag_required) {
+		auto wasted = wasted_space();
 		defrag();
+		this->on_defrag(wasted);
 		result = add_node(trie_header, start, required_size, key, 0, val);
 	}
 
@@ -272,113 +595,911 @@ trie::result trie::write(const std::string& key, long val) {
 }
 
 
-bool trie::remove(const std::string& key) {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::write(const char* key, size_t size, ValueT val) {
+	return write(std::string_view(key, size), val);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::remove(std::string_view key) {
+	timed_operation<Instrumentation> timed{ *this, trie_operation::remove, this->start_timing() };
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
 	if (trie_header->items_count == 0)
 		return false;
 
-	auto start = (node_header_info*)(_buffer + sizeof(trie_header_info));
+	node_header_info<OffsetT>* path[MAX_TRIE_DEPTH];
+	int depth = 0;
 	int position_in_key = 0;
-	auto match = find_match(_buffer, start, key, position_in_key);
+	auto match = find_match(_buffer, get_root<OffsetT>(_buffer), key, position_in_key, path, &depth);
 	if (match.success == false || match.current->value_offset == 0)
 		return false;
 
+	auto current = match.current;
+	auto current_offset = offset_of<OffsetT>(_buffer, current);
 	trie_header->items_count--;
-	trie_header->used_size -= match.current->key_size + sizeof(node_header_info) + sizeof(long);
-	match.current->value_offset = 0;
+	for (int i = 0; i < depth; i++)
+		path[i]->subtree_count--;
+	if (inside_block<OffsetT>(_buffer, current_offset, current->value_offset) == false)
+		release_block(_buffer, trie_header, current->value_offset);
+	current->value_offset = 0;
+
+	if (depth == 1 || current->children_offset != 0) {
+		// the node stays, only the value at the end of its record goes
+		shrink_block(_buffer, trie_header, current_offset, sizeof(node_header_info<OffsetT>) + current->key_size);
+		return true;
+	}
+
+	// unlink nodes that no longer hold a value or lead to one, the root always stays in place
+	while (depth > 1 && current->value_offset == 0 && current->children_offset == 0) {
+		auto parent = path[depth - 2];
+		remove_child_node<PageSize>(_buffer, trie_header, parent, *(unsigned char*)(_buffer + current->key_offset));
+		release_block(_buffer, trie_header, offset_of<OffsetT>(_buffer, current));
+		current = parent;
+		depth--;
+	}
 
 	return true;
 }
 
-std::pair<bool, long> trie::try_read(const std::string& key) {
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::remove(const char* key, size_t size) {
+	return remove(std::string_view(key, size));
+}
 
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+std::pair<bool, ValueT> basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::try_read(std::string_view key) const {
+	timed_operation<Instrumentation> timed{ *this, trie_operation::read, this->start_timing() };
+	auto base = (char*)_buffer;
 
-	if (trie_header->items_count == 0)
-		return std::make_pair(false, 0);
+	auto trie_header = (trie_header_info<OffsetT>*)base;
 
-	int position_in_key = 0;
-	auto match = find_match(_buffer, (node_header_info*)(_buffer + sizeof(trie_header_info)), key, position_in_key);
-	if (match.success == false || match.current->value_offset == 0)
-		return std::make_pair(false, 0);
+	if (trie_header->items_count == 0) {
+		this->on_lookup(false, 0);
+		return std::make_pair(false, ValueT());
+	}
 
-	auto val = *(long*)(_buffer + match.current->value_offset);
+	int position_in_key = 0;
+	int visited = 0;
+	auto match = find_match(base, get_root<OffsetT>(base), key, position_in_key,
+		(node_header_info<OffsetT>**)nullptr, Instrumentation::enabled ? &visited : nullptr);
+	bool found = match.success && match.current->value_offset != 0;
+	this->on_lookup(found, visited);
+	if (found == false)
+		return std::make_pair(false, ValueT());
+
+	auto val = read_value<ValueT>(base, match.current->value_offset);
 	return std::make_pair(true, val);
 }
 
-void trie::defrag() {
-	std::string s(BUFFER_SIZE, 0);
-	auto temp_buffer = &(s[0]);
-	std::memcpy(temp_buffer, _buffer, BUFFER_SIZE);
-	std::memset(_buffer, 0, BUFFER_SIZE);
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+std::pair<bool, ValueT> basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::try_read_speculative(std::string_view key) const {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	const auto not_found = std::make_pair(false, ValueT());
 
-	auto temp_trie_header = (trie_header_info*)temp_buffer;
-	auto trie_header = (trie_header_info*)_buffer;
-	trie_header->items_count = 0;
-	trie_header->next_alloc = sizeof(trie_header_info);
-	trie_header->used_size = sizeof(trie_header_info);
+	// Everything read is checked to be inside the buffer first, whatever state the trie is in. Each field is
+	// loaded once, and the checks and the lookups after them only use that copy, since the writer may change
+	// the field again in between. The child is found here rather than by find_child, which reads the
+	// children header again.
+	auto readable = [](int offset, int size, int alignment) {
+		return offset >= 0 && offset % alignment == 0 && size >= 0 && size <= BUFFER_SIZE && offset <= BUFFER_SIZE - size;
+	};
 
-	if (temp_trie_header->items_count == 0)
-		return; // nothing else to do
+	if (load_once(trie_header->items_count) <= 0 || key.length() > UINT8_MAX)
+		return not_found;
+
+	int position_in_key = 0;
+	int current_offset = load_once(trie_header->root_offset);
+	for (int depth = 0; depth < MAX_TRIE_DEPTH; depth++) {
+		if (readable(current_offset, sizeof(node_header_info<OffsetT>), sizeof(OffsetT)) == false)
+			return not_found;
+		auto current = (node_header_info<OffsetT>*)(base + current_offset);
+
+		// a node below the root that consumes nothing of the key would never get anywhere
+		int key_offset = load_once(current->key_offset);
+		int key_size = load_once(current->key_size);
+		if (key_size < (depth == 0 ? 0 : 1) || readable(key_offset, key_size, 1) == false)
+			return not_found;
+		if (key_size > (int)key.length() - position_in_key ||
+			common_prefix_length(base + key_offset, key.data() + position_in_key, key_size) != key_size)
+			return not_found;
+		position_in_key += key_size;
+
+		if (position_in_key == (int)key.length()) {
+			int value_offset = load_once(current->value_offset);
+			if (value_offset == 0 || readable(value_offset, sizeof(ValueT), 1) == false)
+				return not_found;
+			return std::make_pair(true, read_value<ValueT>(base, value_offset));
+		}
+
+		int children_offset = load_once(current->children_offset);
+		if (children_offset == 0 || readable(children_offset, sizeof(children_header_info<OffsetT>), sizeof(OffsetT)) == false)
+			return not_found;
+		auto children = get_children<OffsetT>(base, (OffsetT)children_offset);
+		auto kind = load_once(children->kind);
+		int count = load_once(children->count);
+		if (kind > node256 || readable(children_offset, children_size<OffsetT>(kind), sizeof(OffsetT)) == false ||
+			count < 0 || count > children_capacity(kind))
+			return not_found;
+
+		auto first_byte = (unsigned char)key[position_in_key];
+		int child_offset = 0;
+		switch (kind) {
+		case node4:
+		case node16: {
+			auto first_bytes = sorted_first_bytes(children);
+			auto offsets = (OffsetT*)(first_bytes + children_capacity(kind));
+			for (int i = 0; i < count; i++) {
+				if (load_once(first_bytes[i]) == first_byte) {
+					child_offset = load_once(offsets[i]);
+					break;
+				}
+			}
+			break;
+		}
+		case node48: {
+			int slot = load_once(indexed_slots(children)[first_byte]);
+			if (slot == 0 || slot > 48)
+				return not_found;
+			child_offset = load_once(indexed_offsets(children)[slot - 1]);
+			break;
+		}
+		default:
+			child_offset = load_once(direct_offsets(children)[first_byte]);
+		}
+		if (child_offset == 0)
+			return not_found;
+		current_offset = child_offset;
+	}
+	return not_found;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+std::pair<bool, ValueT> basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::try_read(const char* key, size_t size) const {
+	return try_read(std::string_view(key, size));
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+std::tuple<bool, size_t, ValueT> basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::longest_prefix_match(std::string_view key) const {
+	auto base = (char*)_buffer;
 
-	std::stack<std::pair<node_header_info*, short*>> nodes;
-	nodes.push(std::make_pair((node_header_info*)(temp_buffer + sizeof(trie_header_info)), (short*)nullptr));
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	auto longest = std::make_tuple(false, (size_t)0, ValueT());
+	if (trie_header->items_count == 0)
+		return longest;
+
+	// every node whose whole key matched, and that has a value, is a longer match than the ones before it
+	auto current = get_root<OffsetT>(base);
+	int position_in_key = 0;
+	while (true) {
+		MatchResult<OffsetT> match;
+		if (match_fragment(base, current, key, position_in_key, match) == false) {
+			if (match.position_in_current_node == current->key_size && current->value_offset != 0)
+				longest = std::make_tuple(true, (size_t)position_in_key, read_value<ValueT>(base, current->value_offset));
+			return longest;
+		}
+
+		if (current->value_offset != 0)
+			longest = std::make_tuple(true, (size_t)position_in_key, read_value<ValueT>(base, current->value_offset));
 
-	node_header_info* current;
+		auto child = find_child(base, (unsigned char)key[position_in_key], current->children_offset);
+		if (child == nullptr)
+			return longest;
+		current = child;
+	}
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::write_route(std::string_view route, ValueT val) {
+	if (route.length() > UINT8_MAX)
+		return result::key_too_large;
+
+	// the names of the placeholders don't matter for matching, only where they are
+	char key[UINT8_MAX];
+	size_t key_size = 0;
+	for (size_t i = 0; i < route.length(); i++) {
+		auto end = route[i] == '{' ? route.find('}', i) : std::string_view::npos;
+		if (end == std::string_view::npos) {
+			key[key_size++] = route[i];
+			continue;
+		}
+		key[key_size++] = i + 1 < end && route[i + 1] == '*' ? ROUTE_CATCH_ALL : ROUTE_PARAMETER;
+		i = end;
+	}
 
-	while (nodes.size() > 0) {
-		
-		short* write_position;
-		std::tie(current, write_position) = nodes.top();
-		nodes.pop();
+	return write(std::string_view(key, key_size), val);
+}
 
-		auto required_size = current->key_size + sizeof(long) + sizeof(node_header_info);
-		if (current->children_offset != 0) {
-			required_size += sizeof(char) + (*(temp_buffer + current->children_offset) * sizeof(short));
+template<typename ValueT>
+struct route_match_state {
+	std::string_view path;
+	std::string_view* captures;
+	size_t max_captures;
+	size_t captured;
+	ValueT value;
+};
+
+// Matches the rest of the path against the node's key and then its children, backtracking to the next
+// kind of child if a branch doesn't lead to a route. The depth is bounded by the depth of the trie.
+template<typename OffsetT, typename ValueT>
+bool match_route_node(char* base, node_header_info<OffsetT>* node, size_t position_in_path, size_t captured, route_match_state<ValueT>& state) {
+
+	auto path = state.path;
+	auto key = base + node->key_offset;
+	for (int i = 0; i < node->key_size; i++) {
+		if (key[i] == ROUTE_PARAMETER || key[i] == ROUTE_CATCH_ALL) {
+			auto end = key[i] == ROUTE_CATCH_ALL ? path.length() : std::min(path.find('/', position_in_path), path.length());
+			if (end == position_in_path && key[i] == ROUTE_PARAMETER)
+				return false; // a parameter needs a non empty segment
+			if (captured < state.max_captures)
+				state.captures[captured] = path.substr(position_in_path, end - position_in_path);
+			captured++;
+			position_in_path = end;
 		}
-		
-		if (write_position != nullptr)
-			*write_position = trie_header->next_alloc;
-
-		auto defraged = (node_header_info*)(_buffer + trie_header->next_alloc);
-		defraged->key_offset = trie_header->next_alloc + sizeof(node_header_info);
-		defraged->key_size = current->key_size;
-		
-		std::memcpy(_buffer + trie_header->next_alloc + sizeof(node_header_info), temp_buffer + current->key_offset, current->key_size);
-		if (current->value_offset == 0) {
-			defraged->value_offset = 0;
+		else if (position_in_path == path.length() || path[position_in_path] != key[i]) {
+			return false;
 		}
 		else {
-			defraged->value_offset = defraged->key_offset + defraged->key_size;
-			std::memcpy(_buffer + defraged->value_offset, temp_buffer + current->value_offset, sizeof(long));
-			trie_header->items_count++;
-			
+			position_in_path++;
 		}
+	}
 
-		if (current->children_offset == 0) {
-			defraged->children_offset = 0;
-		} 
-		else {
-			defraged->children_offset = defraged->key_offset + defraged->key_size + sizeof(long);
-			auto number_of_children_p = (_buffer + defraged->children_offset);
-			auto children_offsets = (short*)(temp_buffer + current->children_offset + 1);
-			auto defraged_children = (short*)(_buffer + defraged->children_offset + 1);
-			for (char i = 0; i < *(temp_buffer + current->children_offset); i++)
-			{
-				if (children_offsets[i] == 0)
-					continue;
-				auto child = (node_header_info*)(temp_buffer + children_offsets[i]);
-			
-				nodes.push(std::make_pair(child, &defraged_children[*number_of_children_p]));
-				(*number_of_children_p)++;
+	if (position_in_path == path.length() && node->value_offset != 0) {
+		state.captured = captured;
+		state.value = read_value<ValueT>(base, node->value_offset);
+		return true;
+	}
+
+	if (node->children_offset == 0)
+		return false;
+
+	if (position_in_path < path.length() && path[position_in_path] != ROUTE_PARAMETER && path[position_in_path] != ROUTE_CATCH_ALL) {
+		auto literal = find_child(base, (unsigned char)path[position_in_path], node->children_offset);
+		if (literal != nullptr && match_route_node(base, literal, position_in_path, captured, state))
+			return true;
+	}
+
+	for (auto placeholder : { ROUTE_PARAMETER, ROUTE_CATCH_ALL }) {
+		auto child = find_child(base, (unsigned char)placeholder, node->children_offset);
+		if (child != nullptr && match_route_node(base, child, position_in_path, captured, state))
+			return true;
+	}
+
+	return false;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+std::pair<bool, ValueT> basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::match_route(std::string_view path, std::string_view* captures,
+	size_t max_captures, size_t& captured) const {
+	auto base = (char*)_buffer;
+
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	captured = 0;
+	if (trie_header->items_count == 0)
+		return std::make_pair(false, ValueT());
+
+	route_match_state<ValueT> state{ path, captures, max_captures, 0, ValueT() };
+	if (match_route_node(base, get_root<OffsetT>(base), 0, 0, state) == false)
+		return std::make_pair(false, ValueT());
+
+	captured = state.captured;
+	return std::make_pair(true, state.value);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::try_read_many(const std::string_view* keys, size_t count, std::pair<bool, ValueT>* results) const {
+	// Interleaving the lookups of a group, and prefetching the next node of each, didn't pay for its
+	// bookkeeping: these tries are small enough to stay in cache, and the url keys were slower either way.
+	for (size_t i = 0; i < count; i++)
+		results[i] = try_read(keys[i]);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::iterator(char* base) : _base(base), _depth(0) {
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::push(OffsetT node_offset) {
+	auto node = (node_header_info<OffsetT>*)(_base + node_offset);
+	auto key_size = _depth == 0 ? 0 : _stack[_depth - 1].key_size;
+	std::memcpy(_key + key_size, _base + node->key_offset, node->key_size);
+	_stack[_depth++] = frame{ node_offset, 0, (short)(key_size + node->key_size) };
+}
+
+// Moves to the next node with a value, in depth first order, visiting the children in the order of their first byte.
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::find_next(bool include_current) {
+	while (_depth > 0) {
+		auto& top = _stack[_depth - 1];
+		auto node = (node_header_info<OffsetT>*)(_base + top.node_offset);
+		if (include_current && node->value_offset != 0)
+			return;
+
+		unsigned char first_byte;
+		auto child_offset = node->children_offset == 0 || top.next_first_byte > UINT8_MAX ? 0 :
+			next_child(get_children<OffsetT>(_base, node->children_offset), top.next_first_byte, first_byte);
+
+		if (child_offset == 0) {
+			_depth--; // done with this node, and its value was already visited
+			include_current = false;
+			continue;
+		}
+
+		top.next_first_byte = first_byte + 1;
+		push(child_offset);
+		include_current = true;
+	}
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::operator*() const -> value_type {
+	auto& top = _stack[_depth - 1];
+	auto node = (node_header_info<OffsetT>*)(_base + top.node_offset);
+	return std::make_pair(std::string_view(_key, top.key_size), read_value<ValueT>(_base, node->value_offset));
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::operator++() -> iterator& {
+	find_next(false);
+	return *this;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::operator++(int) -> iterator {
+	auto copy = *this;
+	find_next(false);
+	return copy;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::operator==(const iterator& other) const {
+	return _depth == other._depth &&
+		(_depth == 0 || _stack[_depth - 1].node_offset == other._stack[_depth - 1].node_offset);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::iterator::operator!=(const iterator& other) const {
+	return (*this == other) == false;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::begin() const -> iterator {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	iterator it(base);
+	if (trie_header->items_count == 0)
+		return it;
+
+	it.push(trie_header->root_offset);
+	it.find_next(true);
+	return it;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::end() const -> iterator {
+	auto base = (char*)_buffer;
+	return iterator(base);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::lower_bound(std::string_view key) const -> iterator {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	iterator it(base);
+	if (trie_header->items_count == 0)
+		return it;
+
+	it.push(trie_header->root_offset);
+	int position_in_key = 0;
+	while (true) {
+		auto& top = it._stack[it._depth - 1];
+		auto node = (node_header_info<OffsetT>*)(base + top.node_offset);
+		auto rest_of_key = (int)key.length() - position_in_key;
+		auto matched = common_prefix_length(base + node->key_offset, key.data() + position_in_key,
+			std::min((int)node->key_size, rest_of_key));
+
+		if (matched == rest_of_key) {
+			it.find_next(true); // the key ends here, so everything from this node on comes after it
+			return it;
+		}
+
+		if (matched < node->key_size) {
+			// the node and everything under it comes either before or after the key
+			if (*(unsigned char*)(base + node->key_offset + matched) < (unsigned char)key[position_in_key + matched]) {
+				it._depth--;
+				it.find_next(false);
 			}
+			else {
+				it.find_next(true);
+			}
+			return it;
 		}
 
-		trie_header->next_alloc += (short)required_size;
-		trie_header->used_size += (short)required_size;
+		// this node's key is a prefix of the key, so it comes before it, and so do the children before the next byte
+		position_in_key += node->key_size;
+		auto first_byte = (unsigned char)key[position_in_key];
+		auto child = node->children_offset == 0 ? nullptr : find_child(base, first_byte, node->children_offset);
+		if (child == nullptr) {
+			top.next_first_byte = first_byte;
+			it.find_next(false);
+			return it;
+		}
 
+		top.next_first_byte = first_byte + 1;
+		it.push(offset_of<OffsetT>(base, child));
 	}
+}
+
+// The node where the entries that start with the prefix are, or nullptr if there are none.
+// The prefix may end in the middle of the node's key, path gets the nodes on the way to it.
+template<typename OffsetT>
+node_header_info<OffsetT>* find_prefix(char* base, std::string_view prefix, node_header_info<OffsetT>** path, int* depth) {
+	if (((trie_header_info<OffsetT>*)base)->items_count == 0)
+		return nullptr;
+
+	int position_in_key = 0;
+	auto match = find_match(base, get_root<OffsetT>(base), prefix, position_in_key, path, depth);
+	if (match.success == false && position_in_key != (int)prefix.length())
+		return nullptr;
+	return match.current;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+int basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::count_prefix(std::string_view prefix) const {
+	auto base = (char*)_buffer;
+	node_header_info<OffsetT>* path[MAX_TRIE_DEPTH];
+	int depth = 0;
+	auto node = find_prefix(base, prefix, path, &depth);
+	return node == nullptr ? 0 : node->subtree_count;
+}
+
+// An iterator over the entries under the prefix, which ends once it is done with them, since
+// the nodes on the way to the prefix are marked as having no further children to visit.
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::prefix_scan(std::string_view prefix) const -> iterator {
+	auto base = (char*)_buffer;
+	iterator it(base);
+	node_header_info<OffsetT>* path[MAX_TRIE_DEPTH];
+	int depth = 0;
+	if (find_prefix(base, prefix, path, &depth) == nullptr)
+		return it;
+
+	for (int i = 0; i < depth; i++) {
+		it.push(offset_of<OffsetT>(base, path[i]));
+		it._stack[i].next_first_byte = UINT8_MAX + 1;
+	}
+	it._stack[depth - 1].next_first_byte = 0;
+	it.find_next(true);
+	return it;
+}
+
+// Writes the node for [first, last), all of which share the first depth bytes of their keys, and then
+// its children, in the same layout defrag produces. Returns the node's offset, or 0 if there isn't enough room.
+template<size_t PageSize, typename OffsetT, typename ValueT>
+OffsetT bulk_load_node(char* base, trie_header_info<OffsetT>* trie_header,
+	const std::pair<std::string_view, ValueT>* first, const std::pair<std::string_view, ValueT>* last, int depth) {
+
+	// the input is sorted, so what the first and last keys share is shared by all of them
+	auto first_key = first->first;
+	auto last_key = (last - 1)->first;
+	auto key_size = common_prefix_length(first_key.data() + depth, last_key.data() + depth,
+		(int)std::min(first_key.length(), last_key.length()) - depth);
+	int end_of_node = depth + key_size;
+
+	bool has_value = first_key.length() == (size_t)end_of_node;
+	auto children_begin = has_value ? first + 1 : first;
+
+	int number_of_children = 0;
+	for (auto it = children_begin; it != last; number_of_children++) {
+		auto first_byte = it->first[end_of_node];
+		while (it != last && it->first[end_of_node] == first_byte)
+			it++;
+	}
+
+	int node_size = sizeof(node_header_info<OffsetT>) + key_size + (has_value ? sizeof(ValueT) : 0);
+	int required_size = block_size_for<OffsetT>(node_size);
+	if (number_of_children > 0)
+		required_size += block_size_for<OffsetT>(children_size<OffsetT>(tightest_children_kind(number_of_children)));
+
+	if (trie_header->next_alloc + required_size > allocation_limit<PageSize, OffsetT>())
+		return 0;
+
+	auto offset = allocate_block(base, trie_header, node_size, node_block, (OffsetT)0);
+
+	auto node = (node_header_info<OffsetT>*)(base + offset);
+	node->key_offset = offset + sizeof(node_header_info<OffsetT>);
+	node->key_size = (OffsetT)key_size;
+	std::memcpy(base + node->key_offset, first_key.data() + depth, key_size);
+
+	node->subtree_count = (OffsetT)(last - first);
+	node->value_offset = 0;
+	if (has_value) {
+		node->value_offset = node->key_offset + node->key_size;
+		write_value(base, node->value_offset, first->second);
+	}
+
+	node->children_offset = 0;
+	if (number_of_children > 0) {
+		auto kind = tightest_children_kind(number_of_children);
+		node->children_offset = allocate_block(base, trie_header, children_size<OffsetT>(kind), children_block,
+			offset_of<OffsetT>(base, &node->children_offset));
+		auto children = get_children<OffsetT>(base, node->children_offset);
+		init_children(children, kind);
+
+		for (auto it = children_begin; it != last;) {
+			auto first_byte = it->first[end_of_node];
+			auto group_begin = it;
+			while (it != last && it->first[end_of_node] == first_byte)
+				it++;
+
+			auto child_offset = bulk_load_node<PageSize>(base, trie_header, group_begin, it, end_of_node);
+			if (child_offset == 0)
+				return 0;
+			link_child(base, children, (unsigned char)first_byte, child_offset);
+		}
+	}
+
+	return offset;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::bulk_load(const std::pair<std::string_view, ValueT>* items, size_t count) {
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (items[i].first.length() > UINT8_MAX)
+			return result::key_too_large;
+		if (i > 0 && (items[i - 1].first < items[i].first) == false)
+			return result::keys_not_sorted;
+	}
+
+	if (count > (size_t)std::numeric_limits<OffsetT>::max())
+		return result::max_number_of_items_stored;
+
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	reset_trie_header(trie_header);
+
+	if (count == 0)
+		return result::success;
+
+	auto root_offset = bulk_load_node<PageSize>(_buffer, trie_header, items, items + count, 0);
+	if (root_offset == 0) {
+		reset_trie_header(trie_header);
+		return result::not_enough_space;
+	}
+
+	trie_header->root_offset = root_offset;
+	get_block<OffsetT>(_buffer, root_offset)->owner = offset_of<OffsetT>(_buffer, &trie_header->root_offset);
+	trie_header->items_count = (OffsetT)count;
+
+	return result::success;
+}
+
+// Copies a node from the old buffer to the end of the trie, with its key and value packed right after
+// its header, and its children right after that. The copied children offsets still point into the old buffer.
+template<typename ValueT, typename OffsetT>
+OffsetT copy_node(char* base, trie_header_info<OffsetT>* trie_header, char* old_base, node_header_info<OffsetT>* old, OffsetT owner) {
+
+	int node_size = sizeof(node_header_info<OffsetT>) + old->key_size + (old->value_offset != 0 ? sizeof(ValueT) : 0);
+	auto offset = allocate_block(base, trie_header, node_size, node_block, owner);
+	auto copy = (node_header_info<OffsetT>*)(base + offset);
+
+	copy->key_offset = offset + sizeof(node_header_info<OffsetT>);
+	copy->key_size = old->key_size;
+	copy->subtree_count = old->subtree_count;
+	std::memcpy(base + copy->key_offset, old_base + old->key_offset, old->key_size);
+
+	copy->value_offset = 0;
+	if (old->value_offset != 0) {
+		copy->value_offset = copy->key_offset + copy->key_size;
+		std::memcpy(base + copy->value_offset, old_base + old->value_offset, sizeof(ValueT));
+		trie_header->items_count++;
+	}
+
+	copy->children_offset = 0;
+	if (old->children_offset != 0) {
+		auto old_children = get_children<OffsetT>(old_base, old->children_offset);
+		auto kind = tightest_children_kind(old_children->count);
+		copy->children_offset = allocate_block(base, trie_header, children_size<OffsetT>(kind), children_block,
+			offset_of<OffsetT>(base, &copy->children_offset));
+		auto children = get_children<OffsetT>(base, copy->children_offset);
+		init_children(children, kind);
+		for_each_child(old_children, [children](unsigned char first_byte, OffsetT& child_offset) {
+			add_child(children, first_byte, child_offset);
+		});
+	}
+
+	return offset;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+char* basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::thread_scratch() {
+	static thread_local std::unique_ptr<char[]> scratch;
+	if (scratch == nullptr)
+		scratch.reset(new char[PageSize]);
+	return scratch.get();
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::defrag() {
+	defrag(thread_scratch());
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::defrag(char* scratch) {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	std::memcpy(scratch, _buffer, trie_header->next_alloc);
+
+	auto old_trie_header = (trie_header_info<OffsetT>*)scratch;
+	reset_trie_header(trie_header);
+
+	if (old_trie_header->items_count == 0) {
+		update_checksum();
+		return; // nothing else to do
+	}
+
+	trie_header->root_offset = copy_node<ValueT>(_buffer, trie_header, scratch, get_root<OffsetT>(scratch),
+		offset_of<OffsetT>(_buffer, &trie_header->root_offset));
+
+	// The copied blocks are the queue of nodes whose children still need copying, so there is no need
+	// for a stack. Once the scan catches up with the allocations, every node has been moved.
+	OffsetT scan = sizeof(trie_header_info<OffsetT>);
+	while (scan < trie_header->next_alloc) {
+		auto block = (block_header_info<OffsetT>*)(_buffer + scan);
+
+		if (block_kind(block) == children_block) {
+			auto trie_buffer = _buffer;
+			for_each_child(get_children<OffsetT>(_buffer, offset_of<OffsetT>(_buffer, block + 1)),
+				[trie_buffer, trie_header, scratch](unsigned char, OffsetT& offset) {
+				offset = copy_node<ValueT>(trie_buffer, trie_header, scratch, (node_header_info<OffsetT>*)(scratch + offset),
+					offset_of<OffsetT>(trie_buffer, &offset));
+			});
+		}
+
+		scan += block_size(block);
+	}
+	update_checksum();
 #if DEBUG
 	validate();
 #endif
 }
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::defrag_step(int budget_bytes) {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+
+	// Slides the live blocks after the cursor down over the free ones, so the free space gathers in
+	// a single block that moves up the trie until it reaches next_alloc and can be given back.
+	// Blocks freed behind the cursor in the meantime are left for the next pass.
+	auto cursor = trie_header->compaction_cursor;
+	while (budget_bytes > 0 && wasted_space() > 0) {
+		if (cursor >= trie_header->next_alloc)
+			cursor = sizeof(trie_header_info<OffsetT>);
+
+		auto block = (block_header_info<OffsetT>*)(_buffer + cursor);
+		if (block_kind(block) != free_block) {
+			cursor += block_size(block);
+			budget_bytes -= block_size(block);
+			continue;
+		}
+
+		// gather the free blocks up to the next live one
+		auto live = cursor;
+		while (live < trie_header->next_alloc && block_kind((block_header_info<OffsetT>*)(_buffer + live)) == free_block) {
+			unlink_free_block(_buffer, trie_header, (block_header_info<OffsetT>*)(_buffer + live));
+			live += block_size((block_header_info<OffsetT>*)(_buffer + live));
+		}
+
+		if (live == trie_header->next_alloc) {
+			trie_header->next_alloc = cursor;
+			break;
+		}
+
+		auto free_size = (OffsetT)(live - cursor);
+		auto size = block_size((block_header_info<OffsetT>*)(_buffer + live));
+		move_block(_buffer, live, cursor);
+		cursor += size;
+		budget_bytes -= size;
+
+		add_free_block(_buffer, trie_header, (block_header_info<OffsetT>*)(_buffer + cursor), free_size);
+	}
+
+	trie_header->compaction_cursor = cursor;
+	return wasted_space() == 0;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::set_compaction_policy(int wasted_space_threshold, int step_budget_bytes) {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	trie_header->compaction_threshold = (OffsetT)wasted_space_threshold;
+	trie_header->compaction_budget = (OffsetT)step_budget_bytes;
+}
+
+// Swaps the byte order of every field in the trie, between the host's and little endian, walking the blocks to
+// find them. to_host tells which way it goes, since the sizes and offsets that the walk needs are in host order
+// only on one side of the swap.
+template<typename OffsetT, typename ValueT>
+void swap_byte_order(char* base, bool to_host) {
+	auto swap = [to_host](auto& field) {
+		auto before = field;
+		field = byte_swap(field);
+		return to_host ? field : before;
+	};
+
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	auto next_alloc = swap(trie_header->next_alloc);
+	swap(trie_header->used_size);
+	swap(trie_header->items_count);
+	swap(trie_header->format);
+	swap(trie_header->root_offset);
+	swap(trie_header->compaction_cursor);
+	swap(trie_header->compaction_threshold);
+	swap(trie_header->compaction_budget);
+	for (auto& head : trie_header->free_lists)
+		swap(head);
+	swap(trie_header->checksum);
+
+	OffsetT offset = sizeof(trie_header_info<OffsetT>);
+	while (offset < next_alloc) {
+		auto block = (block_header_info<OffsetT>*)(base + offset);
+		auto size_and_kind = swap(block->size_and_kind);
+		auto size = (OffsetT)(size_and_kind & ~3);
+		swap(block->owner);
+
+		auto payload = (OffsetT)(offset + sizeof(block_header_info<OffsetT>));
+		switch (size_and_kind & 3) {
+		case free_block:
+			if (size >= min_listed_block_size<OffsetT>()) {
+				swap(get_free_links(block)->next);
+				swap(get_free_links(block)->prev);
+			}
+			break;
+		case node_block: {
+			auto node = (node_header_info<OffsetT>*)(base + payload);
+			swap(node->key_offset);
+			swap(node->key_size);
+			swap(node->children_offset);
+			swap(node->subtree_count);
+			auto value_offset = swap(node->value_offset);
+			if (value_offset >= payload && value_offset < offset + size)
+				write_value(base, value_offset, byte_swap(read_value<ValueT>(base, value_offset)));
+			break;
+		}
+		case children_block: {
+			auto children = get_children<OffsetT>(base, payload);
+			swap(children->count);
+			auto offsets = children->kind == node48 ? indexed_offsets(children) :
+				children->kind == node256 ? direct_offsets(children) : sorted_offsets(children);
+			for (int i = 0; i < children_capacity(children->kind); i++)
+				swap(offsets[i]);
+			break;
+		}
+		default:
+			write_value(base, payload, byte_swap(read_value<ValueT>(base, payload)));
+			break;
+		}
+
+		offset += size;
+	}
+}
+
+// the CRC32C of a trie, which covers all of it up to next_alloc but the checksum field
+template<typename OffsetT>
+uint32_t trie_checksum(const char* data, size_t size) {
+	auto field = offsetof(trie_header_info<OffsetT>, checksum);
+	auto crc = crc32c(0, data, field);
+	return crc32c(crc, data + field + sizeof(uint32_t), size - field - sizeof(uint32_t));
+}
+
+template<size_t PageSize, typename OffsetT>
+trie_base::result check_serialized(const char* data, size_t size) {
+	if (size < sizeof(trie_header_info<OffsetT>) || size > PageSize)
+		return trie_base::result::invalid_format;
+
+	trie_header_info<OffsetT> trie_header;
+	std::memcpy(&trie_header, data, sizeof(trie_header));
+	if (little_endian(trie_header.format) != trie_format<OffsetT>() || (size_t)little_endian(trie_header.next_alloc) != size)
+		return trie_base::result::invalid_format;
+
+	if (little_endian(trie_header.checksum) != trie_checksum<OffsetT>(data, size))
+		return trie_base::result::checksum_mismatch;
+
+	return trie_base::result::success;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::update_checksum() {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	trie_header->checksum = trie_checksum<OffsetT>(_buffer, trie_header->next_alloc);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::verify_checksum() const {
+	auto trie_header = (trie_header_info<OffsetT>*)_buffer;
+	if (trie_header->next_alloc < (OffsetT)sizeof(trie_header_info<OffsetT>) || trie_header->next_alloc > BUFFER_SIZE)
+		return false;
+	return trie_header->checksum == trie_checksum<OffsetT>(_buffer, trie_header->next_alloc);
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::snapshot() const -> std::unique_ptr<basic_trie> {
+	auto copy = std::make_unique<basic_trie>();
+	std::memcpy(copy->_buffer, _buffer, ((trie_header_info<OffsetT>*)_buffer)->next_alloc);
+	return copy;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+size_t basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::serialized_size() const {
+	return ((trie_header_info<OffsetT>*)_buffer)->next_alloc;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::serialize(char* output) const {
+	static_assert(sizeof(ValueT) == sizeof(int64_t), "serialized tries have 64 bit values");
+
+	auto size = serialized_size();
+	std::memcpy(output, _buffer, size);
+#if TRIE_BIG_ENDIAN
+	swap_byte_order<OffsetT, ValueT>(output, false);
+#endif
+
+	auto checksum = little_endian(trie_checksum<OffsetT>(output, size));
+	std::memcpy(output + offsetof(trie_header_info<OffsetT>, checksum), &checksum, sizeof(checksum));
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_base::result basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::load(const char* data, size_t size) {
+	static_assert(sizeof(ValueT) == sizeof(int64_t), "serialized tries have 64 bit values");
+
+	auto result = check_serialized<PageSize, OffsetT>(data, size);
+	if (result != result::success)
+		return result;
+
+	// The checksum only catches damage, not data made to pass it, so the trie is validated before anything
+	// trusts its offsets. That happens on a copy, so a trie that doesn't pass leaves this one as it was. The
+	// copy is checked as a trie without instrumentation, which is the same buffer with nothing before it.
+	auto copy = thread_scratch();
+	std::memcpy(copy, data, size);
+#if TRIE_BIG_ENDIAN
+	swap_byte_order<OffsetT, ValueT>(copy, true);
+#endif
+	validation_report report;
+	if (((const basic_trie<PageSize, OffsetT, ValueT>*)copy)->validate(report) == false)
+		return result::invalid_format;
+
+	std::memcpy(_buffer, copy, size);
+	return result::success;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+auto basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::view(const char* data, size_t size, result& result) -> const basic_trie* {
+	result = check_serialized<PageSize, OffsetT>(data, size);
+	if (result != result::success)
+		return nullptr;
+	if ((uintptr_t)data % alignof(basic_trie) != 0) {
+		result = result::invalid_format;
+		return nullptr;
+	}
+	if constexpr (sizeof(basic_trie) != PageSize) {
+		result = result::invalid_format; // the stats of the instrumentation come before the buffer
+		return nullptr;
+	}
+#if TRIE_BIG_ENDIAN
+	result = result::invalid_format;
+	return nullptr;
+#else
+	// like load, the offsets are checked before anything follows them
+	auto view = (const basic_trie*)data;
+	validation_report report;
+	if (view->validate(report) == false) {
+		result = result::invalid_format;
+		return nullptr;
+	}
+	return view;
+#endif
+}
+
+template class basic_trie<4 * 1024, short, int64_t>;
+template class basic_trie<32 * 1024, short, int64_t>;
+template class basic_trie<4 * 1024 * 1024, int, int64_t>;
+template class basic_trie<32 * 1024, short, int64_t, trie_instrumentation>;
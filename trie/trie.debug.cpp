@@ -2,82 +2,299 @@
 #include "trie.h"
 #include "trie.impl.h"
 
-void trie::validate() {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::validate() const {
+	validation_report report;
+	if (validate(report) == false)
+		std::cerr << report.message << " at " << report.offset << std::endl;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+bool basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::validate(validation_report& report) const {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	const int header_size = sizeof(trie_header_info<OffsetT>);
+	const int block_header_size = sizeof(block_header_info<OffsetT>);
+
+	auto fail = [&report](validation_error error, int offset, const char* message) {
+		report = validation_report{ error, offset, message };
+		return false;
+	};
+	report = validation_report{ valid, 0, nullptr };
 
-	bool error = false;
+	if (trie_header->format != trie_format<OffsetT>())
+		return fail(invalid_header, 0, "unknown format");
 	if (trie_header->items_count < 0)
-	{
-		std::cerr << "negative item count" << std::endl;
-		error = true;
-	}
+		return fail(invalid_header, 0, "negative item count");
+	if (trie_header->next_alloc < header_size || trie_header->next_alloc > BUFFER_SIZE)
+		return fail(invalid_header, 0, "allocation outside of the buffer");
+	if (trie_header->used_size < header_size || trie_header->used_size > trie_header->next_alloc)
+		return fail(invalid_header, 0, "size greater than allocation");
+
+	int next_alloc = trie_header->next_alloc;
+
+	// whether a payload of size bytes at offset is past the trie header and before next_alloc
+	auto in_range = [header_size, next_alloc](int offset, int size) {
+		return offset >= header_size + (int)sizeof(block_header_info<OffsetT>) && size >= 0 && offset + size <= next_alloc;
+	};
 
-	if (trie_header->used_size > trie_header->next_alloc) {
-		std::cerr << "size greater than allocation" << std::endl;
-		error = true;
+	// the blocks must cover everything up to next_alloc, and add up to the used size
+	int live_size = header_size;
+	int listed_blocks = 0;
+	int node_blocks = 0;
+	bool cursor_found = trie_header->compaction_cursor >= next_alloc;
+	int offset = header_size;
+	while (offset < next_alloc) {
+		cursor_found |= offset == trie_header->compaction_cursor;
+		if (offset + block_header_size > next_alloc)
+			return fail(invalid_block, offset, "block header after next alloc");
+
+		auto block = (block_header_info<OffsetT>*)(base + offset);
+		if (block_size(block) <= 0 || offset + block_size(block) > next_alloc)
+			return fail(invalid_block, offset, "invalid block size");
+
+		if (block_kind(block) == free_block) {
+			if (block_size(block) >= min_listed_block_size<OffsetT>())
+				listed_blocks++;
+		}
+		else {
+			live_size += block_size(block);
+			node_blocks += block_kind(block) == node_block ? 1 : 0;
+			if (block->owner <= 0 || block->owner % sizeof(OffsetT) != 0 || block->owner + (int)sizeof(OffsetT) > next_alloc ||
+				*(OffsetT*)(base + block->owner) != offset + block_header_size)
+				return fail(invalid_owner, offset, "block owner doesn't point to the block");
+		}
+		offset += block_size(block);
 	}
 
-	if (trie_header->next_alloc > BUFFER_SIZE) {
-		std::cerr << "allocation greater than buffer size" << std::endl;
-		error = true;
+	if (live_size != trie_header->used_size)
+		return fail(invalid_block, 0, "live blocks don't add up to the used size");
+	if (cursor_found == false)
+		return fail(invalid_header, 0, "compaction cursor isn't at the start of a block");
+
+	for (int i = 0; i < FREE_LISTS_COUNT; i++) {
+		OffsetT prev = 0;
+		for (auto free = trie_header->free_lists[i]; free != 0; free = get_free_links((block_header_info<OffsetT>*)(base + free))->next) {
+			if (free < header_size || free % sizeof(OffsetT) != 0 || free + min_listed_block_size<OffsetT>() > next_alloc)
+				return fail(invalid_free_list, prev, "free list points outside of the trie");
+			auto block = (block_header_info<OffsetT>*)(base + free);
+			if (block_kind(block) != free_block || free_list_index(block_size(block)) != i)
+				return fail(invalid_free_list, free, "free list holds a block that doesn't belong to it");
+			if (get_free_links(block)->prev != prev)
+				return fail(invalid_free_list, free, "free list links don't match");
+			if (--listed_blocks < 0)
+				return fail(invalid_free_list, free, "free list has a cycle");
+			prev = free;
+		}
 	}
 
-	if (error || trie_header->items_count == 0)
-		return;
+	if (listed_blocks != 0)
+		return fail(invalid_free_list, 0, "free blocks missing from the free lists");
 
-	std::stack<node_header_info*> nodes;
-	nodes.push((node_header_info*)(_buffer + sizeof(trie_header_info)));
+	if (trie_header->items_count == 0)
+		return true;
 
-	while (nodes.size() > 0 && error == false) {
-		auto current = nodes.top();
-		nodes.pop();
+	// whether offset is a block of that kind, pointed to by the field at owner, and large enough for size bytes
+	auto owned_block = [base, &in_range](int offset, unsigned char kind, int owner, int size) {
+		if (in_range(offset, size) == false || offset % sizeof(OffsetT) != 0)
+			return false;
+		auto block = get_block<OffsetT>(base, (OffsetT)offset);
+		return block_kind(block) == kind && block->owner == owner && size <= block_size(block) - (int)sizeof(block_header_info<OffsetT>);
+	};
 
-		if (current->key_size < 0 ||
-			current->children_offset < 0 ||
-			current->key_offset < 0 ||
-			current->value_offset < 0) {
-			std::cerr << "negative offsets are not allowed" << std::endl;
-			break;
-		}
+	// everything about a node but its children, which are checked once they are visited
+	auto check_node = [&](int node_offset) {
+		auto node = (node_header_info<OffsetT>*)(base + node_offset);
+		if (node->key_size < 0 || (node->key_size > 0 && in_range(node->key_offset, node->key_size) == false))
+			return fail(invalid_node, node_offset, "key outside of the trie");
 
-		if (current->key_size + current->key_offset > trie_header->next_alloc ||
-			current->children_offset > trie_header->next_alloc ||
-			current->key_offset > trie_header->next_alloc ||
-			current->value_offset > trie_header->next_alloc) {
-			std::cerr << "allocations after next_alloc" << std::endl;
-			break;
+		// the value is either allocated along with the node, or in a block of its own
+		int node_end = node_offset - block_header_size + block_size(get_block<OffsetT>(base, (OffsetT)node_offset));
+		bool value_in_node = node->value_offset >= node_offset && node->value_offset + (int)sizeof(ValueT) <= node_end;
+		if (node->value_offset != 0 && value_in_node == false &&
+			owned_block(node->value_offset, value_block, offset_of<OffsetT>(base, &node->value_offset), sizeof(ValueT)) == false)
+			return fail(invalid_node, node_offset, "value isn't in the node or a value block of its own");
+
+		if (node->children_offset == 0) {
+			if (node->subtree_count != (node->value_offset != 0 ? 1 : 0))
+				return fail(invalid_subtree_count, node_offset, "subtree count of a leaf isn't its own entry");
+			return true;
 		}
 
-		if (current->children_offset != 0) {
+		auto children_owner = offset_of<OffsetT>(base, &node->children_offset);
+		if (owned_block(node->children_offset, children_block, children_owner, sizeof(children_header_info<OffsetT>)) == false)
+			return fail(invalid_children, node_offset, "children aren't a children block of their own");
 
-			if (*(_buffer + current->children_offset) == 0) {
-				std::cerr << "zero children but has children offsets" << std::endl;
-				break;
-			}
+		auto children = get_children<OffsetT>(base, node->children_offset);
+		if (children->kind > node256)
+			return fail(invalid_children, node->children_offset, "unknown children kind");
+		if (owned_block(node->children_offset, children_block, children_owner, children_size<OffsetT>(children->kind)) == false)
+			return fail(invalid_children, node->children_offset, "children block is too small for its kind");
+		if (children->count <= 0 || children->count > children_capacity(children->kind))
+			return fail(invalid_children, node->children_offset, "invalid number of children");
 
-			auto children_offsets = (short*)(_buffer + current->children_offset + sizeof(char));
-			for (char i = 0; i < *(_buffer + current->children_offset); i++)
-			{
-				if (children_offsets[i] == 0)
-					continue;
-				else if (children_offsets[i] > trie_header->next_alloc) {
-					std::cerr << "child offset after next alloc" << std::endl;
-					break;
-				}
-				else if (children_offsets[i] < 0) {
-					std::cerr << "negative child offset" << std::endl;
-					break;
-				}
-				auto child = (node_header_info*)(_buffer + children_offsets[i]);
-				nodes.push(child);
+		if (children->kind == node48) {
+			for (int i = 0; i < 256; i++) {
+				if (indexed_slots(children)[i] > 48)
+					return fail(invalid_children, node->children_offset, "child slot out of range");
 			}
 		}
+		if (children->kind <= node16) {
+			for (int i = 1; i < children->count; i++) {
+				if (sorted_first_bytes(children)[i - 1] >= sorted_first_bytes(children)[i])
+					return fail(invalid_children, node->children_offset, "first bytes of the children aren't sorted");
+			}
+		}
+
+		int number_of_children = 0;
+		int entries_below = 0;
+		const char* error = nullptr;
+		for_each_child(children, [&](unsigned char first_byte, OffsetT& child_offset) {
+			number_of_children++;
+			if (error != nullptr)
+				return;
+			auto child = (node_header_info<OffsetT>*)(base + child_offset);
+			if (owned_block(child_offset, node_block, offset_of<OffsetT>(base, &child_offset), sizeof(node_header_info<OffsetT>)) == false)
+				error = "child isn't a node block of its own";
+			else if (child->key_size <= 0 || in_range(child->key_offset, child->key_size) == false)
+				error = "child key outside of the trie";
+			else if (*(unsigned char*)(base + child->key_offset) != first_byte)
+				error = "child first byte doesn't match its key";
+			else
+				entries_below += child->subtree_count;
+		});
+
+		if (error != nullptr)
+			return fail(invalid_children, node->children_offset, error);
+		if (number_of_children != children->count)
+			return fail(invalid_children, node->children_offset, "number of children doesn't match the children count");
+		if (node->subtree_count != entries_below + (node->value_offset != 0 ? 1 : 0))
+			return fail(invalid_subtree_count, node_offset, "subtree count doesn't match the entries below");
+		return true;
+	};
+
+	if (owned_block(trie_header->root_offset, node_block, offset_of<OffsetT>(base, &trie_header->root_offset), sizeof(node_header_info<OffsetT>)) == false)
+		return fail(invalid_header, 0, "root isn't a node block of its own");
+	if (get_root<OffsetT>(base)->subtree_count != trie_header->items_count)
+		return fail(invalid_subtree_count, trie_header->root_offset, "subtree count of the root doesn't match the number of items");
+
+	// Depth first, with the path on the stack instead of a heap allocated one. Since every child is owned by
+	// the slot it was reached from, no node is visited twice, and the walk ends after node_blocks visits.
+	struct step {
+		OffsetT node;
+		int next_byte;
+	};
+	step path[MAX_TRIE_DEPTH];
+	int depth = 0;
+	int visited = 1;
+	if (check_node(trie_header->root_offset) == false)
+		return false;
+	path[depth++] = step{ trie_header->root_offset, 0 };
+
+	while (depth > 0) {
+		auto& top = path[depth - 1];
+		auto current = (node_header_info<OffsetT>*)(base + top.node);
+		unsigned char first_byte = 0;
+		OffsetT child = current->children_offset == 0 ? 0 : next_child(get_children<OffsetT>(base, current->children_offset), top.next_byte, first_byte);
+		if (child == 0) {
+			depth--;
+			continue;
+		}
+		top.next_byte = first_byte + 1;
+
+		if (depth == MAX_TRIE_DEPTH || ++visited > node_blocks)
+			return fail(invalid_node, child, "trie is deeper than any key");
+		if (check_node(child) == false)
+			return false;
+		path[depth++] = step{ child, 0 };
 	}
+
+	return true;
 }
 
 
-void trie::dump_to_console(bool min) {
-	auto trie_header = (trie_header_info*)_buffer;
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+trie_stats basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::layout_stats() const {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
+	const int block_header_size = sizeof(block_header_info<OffsetT>);
+	const int node_header_size = sizeof(node_header_info<OffsetT>);
+
+	trie_stats stats = {};
+	stats.keys_count = trie_header->items_count;
+	stats.header_bytes = sizeof(trie_header_info<OffsetT>);
+	stats.garbage_bytes = trie_header->next_alloc - trie_header->used_size;
+	stats.unallocated_bytes = BUFFER_SIZE - trie_header->next_alloc;
+	if (trie_header->items_count == 0) {
+		// the next write starts over, so the nodes that are left are as good as free
+		stats.garbage_bytes = trie_header->next_alloc - stats.header_bytes;
+		return stats;
+	}
+
+	// every live block is owned by a node, so counting the node with its value and children counts them all
+	auto count_node = [&](OffsetT node_offset, int depth) {
+		auto node = (node_header_info<OffsetT>*)(base + node_offset);
+		int used = block_header_size + node_header_size + node->key_size;
+		stats.nodes_count++;
+		stats.header_bytes += block_header_size + node_header_size;
+		stats.key_bytes += node->key_size;
+
+		if (node->value_offset != 0) {
+			stats.keys_by_depth[depth]++;
+			stats.value_bytes += sizeof(ValueT);
+			if (inside_block<OffsetT>(base, node_offset, node->value_offset)) {
+				used += sizeof(ValueT);
+			}
+			else {
+				stats.header_bytes += block_header_size;
+				stats.padding_bytes += block_size(get_block<OffsetT>(base, node->value_offset)) - block_header_size - (int)sizeof(ValueT);
+			}
+		}
+		stats.padding_bytes += block_size(get_block<OffsetT>(base, node_offset)) - used;
+
+		if (node->children_offset == 0) {
+			stats.nodes_by_fan_out[0]++;
+			return;
+		}
+		auto children = get_children<OffsetT>(base, node->children_offset);
+		stats.nodes_by_fan_out[children->count]++;
+		stats.children_arrays_by_kind[children->kind]++;
+		stats.header_bytes += block_header_size;
+		stats.children_bytes += children_size<OffsetT>(children->kind);
+		stats.padding_bytes += block_size(get_block<OffsetT>(base, node->children_offset)) - block_header_size - children_size<OffsetT>(children->kind);
+	};
+
+	// depth first, with the path on the stack, like validate
+	struct step {
+		OffsetT node;
+		int next_byte;
+	};
+	step path[MAX_TRIE_DEPTH];
+	int depth = 0;
+	count_node(trie_header->root_offset, 0);
+	path[depth++] = step{ trie_header->root_offset, 0 };
+
+	while (depth > 0) {
+		auto& top = path[depth - 1];
+		auto current = (node_header_info<OffsetT>*)(base + top.node);
+		unsigned char first_byte = 0;
+		OffsetT child = current->children_offset == 0 ? 0 : next_child(get_children<OffsetT>(base, current->children_offset), top.next_byte, first_byte);
+		if (child == 0) {
+			depth--;
+			continue;
+		}
+		top.next_byte = first_byte + 1;
+		count_node(child, depth);
+		path[depth++] = step{ child, 0 };
+	}
+
+	return stats;
+}
+
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation>
+void basic_trie<PageSize, OffsetT, ValueT, Instrumentation>::dump_to_console(bool min) const {
+	auto base = (char*)_buffer;
+	auto trie_header = (trie_header_info<OffsetT>*)base;
 
 	std::cout << "entries " << trie_header->items_count
 		<< " next alloc " << trie_header->next_alloc
@@ -88,10 +305,10 @@ void trie::dump_to_console(bool min) {
 	if (min)
 		return;
 
-	std::stack<std::pair<node_header_info*, size_t>> nodes;
+	std::stack<std::pair<node_header_info<OffsetT>*, size_t>> nodes;
 
 	if (trie_header->items_count > 0) {
-		auto node = (node_header_info*)(_buffer + sizeof(trie_header_info));
+		auto node = get_root<OffsetT>(base);
 		nodes.push(std::make_pair(node, 0));
 	}
 
@@ -108,24 +325,35 @@ void trie::dump_to_console(bool min) {
 			std::cout << " ";
 		}
 
-		std::cout << "key: '" << std::string(_buffer + current->key_offset, current->key_size) << "'";
+		std::cout << "key: '" << std::string(base + current->key_offset, current->key_size) << "'";
 
 		if (current->value_offset != 0) {
-			std::cout << " val: " << *(long*)(_buffer + current->value_offset);
+			std::cout << " val: " << read_value<ValueT>(base, current->value_offset);
 		}
 
 		std::cout << std::endl;
 
 		if (current->children_offset != 0) {
-			auto children_offsets = (short*)(_buffer + current->children_offset + 1);
-			for (char i = 0; i < *(_buffer + current->children_offset); i++)
-			{
-				if (children_offsets[i] == 0)
-					continue;
-
-				auto child = (node_header_info*)(_buffer + children_offsets[i]);
-				nodes.push(std::make_pair(child, ident_level + 1));
-			}
+			for_each_child(get_children<OffsetT>(base, current->children_offset), [&](unsigned char, OffsetT& offset) {
+				nodes.push(std::make_pair((node_header_info<OffsetT>*)(base + offset), ident_level + 1));
+			});
 		}
 	}
 }
+
+template void basic_trie<4 * 1024, short, int64_t>::validate() const;
+template bool basic_trie<4 * 1024, short, int64_t>::validate(trie_base::validation_report&) const;
+template trie_stats basic_trie<4 * 1024, short, int64_t>::layout_stats() const;
+template void basic_trie<4 * 1024, short, int64_t>::dump_to_console(bool) const;
+template void basic_trie<32 * 1024, short, int64_t>::validate() const;
+template bool basic_trie<32 * 1024, short, int64_t>::validate(trie_base::validation_report&) const;
+template trie_stats basic_trie<32 * 1024, short, int64_t>::layout_stats() const;
+template void basic_trie<32 * 1024, short, int64_t>::dump_to_console(bool) const;
+template void basic_trie<4 * 1024 * 1024, int, int64_t>::validate() const;
+template bool basic_trie<4 * 1024 * 1024, int, int64_t>::validate(trie_base::validation_report&) const;
+template trie_stats basic_trie<4 * 1024 * 1024, int, int64_t>::layout_stats() const;
+template void basic_trie<4 * 1024 * 1024, int, int64_t>::dump_to_console(bool) const;
+template void basic_trie<32 * 1024, short, int64_t, trie_instrumentation>::validate() const;
+template bool basic_trie<32 * 1024, short, int64_t, trie_instrumentation>::validate(trie_base::validation_report&) const;
+template trie_stats basic_trie<32 * 1024, short, int64_t, trie_instrumentation>::layout_stats() const;
+template void basic_trie<32 * 1024, short, int64_t, trie_instrumentation>::dump_to_console(bool) const;
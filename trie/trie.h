@@ -1,43 +1,256 @@
-#pragma once
+﻿#pragma once
 
-struct trie_header_info;
-struct node_header_info;
+#include "trie.instrumentation.h"
 
-class trie {
-public:
-	static const int BUFFER_SIZE = 32 * 1024;
+template<typename OffsetT> struct trie_header_info;
+template<typename OffsetT> struct node_header_info;
 
+// what every kind of trie reports back
+class trie_base {
+public:
 	enum result {
 		success,
 		not_enough_space,
 		key_too_large,
 		defrag_required,
-		max_number_of_items_stored
+		max_number_of_items_stored,
+		keys_not_sorted,
+		invalid_format,
+		checksum_mismatch
+	};
+
+	enum validation_error {
+		valid,
+		invalid_header,
+		invalid_block,
+		invalid_owner,
+		invalid_free_list,
+		invalid_node,
+		invalid_children,
+		invalid_subtree_count
+	};
+
+	// the first problem validate found, the message tells what it is, and the offset where it is in the buffer
+	struct validation_report {
+		validation_error error;
+		int offset;
+		const char* message;
+	};
+};
+
+// Where the bytes of a trie go, and the shape it has, see basic_trie::layout_stats. The bytes add up to the
+// size of the buffer.
+struct trie_stats {
+	int keys_count;
+	int nodes_count;
+	int keys_by_depth[UINT8_MAX + 2]; // by the number of nodes above the one that holds the key, 0 for the root
+	int nodes_by_fan_out[UINT8_MAX + 2]; // by their number of children
+	int children_arrays_by_kind[4]; // node4, node16, node48 and node256
+
+	int header_bytes; // the trie header, and the headers of the blocks and of the nodes
+	int key_bytes; // the key fragments of the nodes
+	int padding_bytes; // what the alignment of keys and values, and the rounding of blocks, adds
+	int value_bytes;
+	int children_bytes; // the children arrays, for as many children as their kind holds
+	int garbage_bytes; // the free blocks, which only defrag reclaims in full
+	int unallocated_bytes; // past the allocations
+};
+
+// A trie that lives in a single buffer of PageSize bytes. OffsetT is used for every offset inside the 
+// buffer, as well as for the number of entries, so it must be able to address all of it: 16 bits for 
+// pages of up to 32KB, 32 bits for larger ones. ValueT is what is stored for each key. Instrumentation is
+// told about lookups, splits, defrags and such, see trie_no_instrumentation.
+// The members are instantiated in trie.cpp and trie.debug.cpp for the aliases at the end of this file.
+template<size_t PageSize, typename OffsetT, typename ValueT, typename Instrumentation = trie_no_instrumentation>
+class basic_trie : public trie_base, public Instrumentation {
+	static_assert(std::is_integral<OffsetT>::value && std::is_signed<OffsetT>::value, "offsets must be a signed integer type");
+	static_assert(PageSize <= (size_t)std::numeric_limits<OffsetT>::max() + 1, "the page is too large for its offsets");
+	static_assert(std::is_trivially_copyable<ValueT>::value, "values are copied as raw bytes");
+public:
+	static const int BUFFER_SIZE = (int)PageSize;
+
+	using mapped_type = ValueT;
+
+	// Walks the entries in the order of their keys, writes, removes and defrags invalidate it.
+	// The key it yields points into the iterator, and is only good until it moves on.
+	class iterator {
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::pair<std::string_view, ValueT>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = value_type;
+
+		value_type operator*() const;
+
+		iterator& operator++();
+
+		iterator operator++(int);
+
+		bool operator==(const iterator& other) const;
+
+		bool operator!=(const iterator& other) const;
+	private:
+		friend class basic_trie;
+
+		struct frame {
+			OffsetT node_offset;
+			short next_first_byte; // where the search for the next child to visit starts
+			short key_size; // of the key up to and including this node
+		};
+
+		explicit iterator(char* base);
+
+		void push(OffsetT node_offset);
+
+		void find_next(bool include_current);
+
+		char* _base;
+		int _depth;
+		frame _stack[UINT8_MAX + 2];
+		char _key[UINT8_MAX];
 	};
 
-	trie();
+	basic_trie();
+
+	int entries_count() const;
+
+	int wasted_space() const;
+
+	int available_space_before_defrag() const;
+
+	result write(std::string_view key, ValueT val);
+
+	result write(const char* key, size_t size, ValueT val);
 
-	int entries_count();
+	std::pair<bool, ValueT> try_read(std::string_view key) const;
 
-	int wasted_space();
+	std::pair<bool, ValueT> try_read(const char* key, size_t size) const;
 
-	int available_space_before_defrag();
+	// try_read for a buffer that another thread may be changing, see concurrent_trie. It loads every field
+	// once, checks it before following it and gives up on anything that doesn't add up, so it is safe to run
+	// on a trie in any state, but its result only holds if the trie didn't change while it ran.
+	std::pair<bool, ValueT> try_read_speculative(std::string_view key) const;
 
-	result write(const std::string& key, long val);
+	// Finds the longest stored key that is a prefix of the given key, in a single descent.
+	// Returns whether there is one, its length and its value.
+	std::tuple<bool, size_t, ValueT> longest_prefix_match(std::string_view key) const;
 
-	std::pair<bool, long> try_read(const std::string& key);
+	// Writes a route, where a {name} segment matches any single path segment, and {*name} the rest of the path.
+	result write_route(std::string_view route, ValueT val);
 
-	void dump_to_console(bool min = false);	
+	// Finds the route written with write_route that matches the path, trying literal segments before {name}, 
+	// and {name} before {*name}. Stores the values of the placeholders as views into the path, in order, 
+	// up to max_captures of them, and sets captured to how many there are.
+	std::pair<bool, ValueT> match_route(std::string_view path, std::string_view* captures, size_t max_captures, size_t& captured) const;
 
+	// Looks up each of the count keys and stores what try_read returns for it in results, which must have room
+	// for count entries. It is try_read in a loop, and takes as long, it isn't a faster way to read many keys.
+	void try_read_many(const std::string_view* keys, size_t count, std::pair<bool, ValueT>* results) const;
+
+	iterator begin() const;
+
+	iterator end() const;
+
+	// the first entry whose key is not less than the given key
+	iterator lower_bound(std::string_view key) const;
+
+	// the number of entries whose key starts with the prefix, without going over them
+	int count_prefix(std::string_view prefix) const;
+
+	// calls callback(key, value) for each entry whose key starts with the prefix, in key order, 
+	// the callback must not change the trie
+	template<typename Callback>
+	void for_each_with_prefix(std::string_view prefix, Callback callback) const {
+		for (auto it = prefix_scan(prefix); it != end(); ++it) {
+			auto entry = *it;
+			callback(entry.first, entry.second);
+		}
+	}
+
+	void dump_to_console(bool min = false) const;	
+
+	// the first defrag on a thread allocates the scratch that the thread uses for every one after it
 	void defrag();
 
-	void validate();
+	// scratch must be BUFFER_SIZE bytes, it holds a copy of the trie while it is compacted
+	void defrag(char* scratch);
+
+	// Compacts the trie a piece at a time, moving no more than about budget_bytes of it per call,
+	// so the cost of a defrag can be spread over many calls. Returns true once the trie is compact.
+	bool defrag_step(int budget_bytes);
+
+	// Once wasted_space() reaches the threshold, every write first calls defrag_step with the given budget.
+	// A threshold of 0 turns this off, and leaves it all to the full defrag when the trie runs out of room.
+	void set_compaction_policy(int wasted_space_threshold, int step_budget_bytes);
+
+	result bulk_load(const std::pair<std::string_view, ValueT>* items, size_t count);
+
+	// A copy of the trie as it is now, which only copies the buffer as far as the allocations go.
+	std::unique_ptr<basic_trie> snapshot() const;
+
+	// the number of bytes serialize writes, which is as far as the allocations go, defrag first to make it smaller
+	size_t serialized_size() const;
+
+	// Writes the trie in its portable form, see trie_format, with a checksum. On little endian hosts this 
+	// is a copy of the buffer.
+	void serialize(char* output) const;
+
+	// Replaces the contents of the trie with a serialized one. Its format and size must match, or the result is
+	// invalid_format, then its checksum, or it is checksum_mismatch, and then it must pass validate, or it is
+	// invalid_format again. The trie is left as it was unless the result is success.
+	result load(const char* data, size_t size);
 
-	bool remove(const std::string& key);
+	// Checks a serialized trie like load does, format, checksum and validate, and returns it in place, without
+	// copying it, so it can be read but not changed. The data must outlive the returned trie, and be aligned to
+	// 8 bytes like the buffer of a trie, for the offsets and the checksum in it, data that isn't gets nullptr
+	// with invalid_format. Values are copied out, so they need no alignment of their own. Big endian hosts can't
+	// read the data as is, and get nullptr with invalid_format, they have to load it instead, and so do
+	// instrumented tries.
+	static const basic_trie* view(const char* data, size_t size, result& result);
+
+	// writes what is wrong with the trie, if anything, to std::cerr
+	void validate() const;
+
+	// Checks the whole trie and stops at the first problem, without allocating, and in time bounded by the
+	// size of the allocations. Every offset is checked before it is followed, so it is safe to run on a 
+	// buffer that came from somewhere else, like a mapped file.
+	bool validate(validation_report& report) const;
+
+	// Walks the trie once, and adds up where its bytes go and how deep and wide its nodes are. Allocates nothing,
+	// but trusts the offsets, so validate a trie that came from somewhere else first.
+	trie_stats layout_stats() const;
+
+	// The checksum covers the buffer up to next_alloc. It is set by defrag, and by mapped_trie on flush, 
+	// other changes leave it stale until the next time it is set.
+	void update_checksum();
+
+	bool verify_checksum() const;
+
+	bool remove(std::string_view key);
+
+	bool remove(const char* key, size_t size);
 private:
 
-	trie::result add_node(trie_header_info* trie_header, node_header_info* start, short required_size, const std::string& key, int position_in_key, long val);
+	iterator prefix_scan(std::string_view prefix) const;
+
+	result add_node(trie_header_info<OffsetT>* trie_header, node_header_info<OffsetT>* start, int required_size, std::string_view key, int position_in_key, ValueT val);
+
+	// BUFFER_SIZE bytes for a second copy of the trie, allocated the first time a thread asks for them, and
+	// kept for that thread, so threads that never defrag don't pay for them
+	static char* thread_scratch();
+
+	alignas(8) char _buffer[BUFFER_SIZE];
+
+};
+
+using trie = basic_trie<32 * 1024, short, int64_t>;
+
+// small enough to stay in the L1 cache
+using small_trie = basic_trie<4 * 1024, short, int64_t>;
 
-	char _buffer[BUFFER_SIZE];
+// for large dictionaries, too big to be put on the stack
+using large_trie = basic_trie<4 * 1024 * 1024, int, int64_t>;
 
-};
\ No newline at end of file
+// a trie that keeps a trie_operation_stats, see stats()
+using instrumented_trie = basic_trie<32 * 1024, short, int64_t, trie_instrumentation>;
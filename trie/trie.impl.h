@@ -1,23 +1,427 @@
-#pragma once
+﻿#pragma once
 
+const int FREE_LISTS_COUNT = 8;
+
+// Everything below is templated on the type of the offsets inside the page, 16 bits for pages of up to 32KB,
+// 32 bits for larger ones. Functions that only get offsets, and not a pointer to one of these structures,
+// need it spelled out, since an offset of the wrong width would silently read the wrong layout.
+template<typename T>
+struct non_deduced { using type = T; };
+
+template<typename T>
+using non_deduced_t = typename non_deduced<T>::type;
+
+template<typename OffsetT>
 struct trie_header_info
 {
-	short next_alloc;
-	short used_size;
-	short items_count;
-	short reserved;
+	OffsetT next_alloc;
+	OffsetT used_size;
+	OffsetT items_count;
+	OffsetT format; // see trie_format
+	OffsetT root_offset;
+	OffsetT compaction_cursor; // where the next defrag_step picks up from
+	OffsetT compaction_threshold; // wasted space at which writes start to compact, 0 if they don't
+	OffsetT compaction_budget; // how much each of these writes compacts
+	OffsetT free_lists[FREE_LISTS_COUNT]; // offsets of the first free block of each size class, 0 if none
+	uint32_t checksum; // CRC32C of the serialized trie up to next_alloc, leaving out this field, set by serialize
+};
+
+// The serialized form of a trie is its buffer up to next_alloc, with every field in little endian byte order,
+// and 64 bit values. The format field has 'T' in the high byte, then the version, and then the width of the offsets.
+const int TRIE_FORMAT_VERSION = 1;
+
+template<typename OffsetT>
+constexpr OffsetT trie_format() {
+	return (OffsetT)('T' << 8 | TRIE_FORMAT_VERSION << 4 | sizeof(OffsetT));
+}
+
+enum block_kind : unsigned char {
+	free_block,
+	node_block,
+	children_block,
+	value_block
+};
+
+// Everything in the trie is allocated as a block, and the blocks are laid out one after the other from the
+// trie header to next_alloc. Block sizes are a multiple of the size of a block header, 4 or 8 bytes, so what is
+// split off a block always has room for a header of its own, and the low bits hold the kind. The owner is the
+// offset of the single field that points to the block (a child slot or the root offset for a node, the children
+// or value offset of a node otherwise), which is what allows moving live blocks around. Offsets point past the
+// block header.
+template<typename OffsetT>
+struct block_header_info
+{
+	OffsetT size_and_kind;
+	OffsetT owner;
+};
+
+// Free blocks that are large enough keep the links of their free list in place of the payload.
+// Smaller ones are only reclaimed by compaction.
+template<typename OffsetT>
+struct free_block_info
+{
+	OffsetT next;
+	OffsetT prev;
 };
 
+template<typename OffsetT>
+constexpr int min_listed_block_size() {
+	return sizeof(block_header_info<OffsetT>) + sizeof(free_block_info<OffsetT>);
+}
+
+template<typename OffsetT>
 struct node_header_info
 {
-	short key_offset;
-	short key_size;
-	short children_offset;
-	short value_offset;
+	OffsetT key_offset;
+	OffsetT key_size;
+	OffsetT children_offset;
+	OffsetT value_offset;
+	OffsetT subtree_count; // entries in this node and below it
 };
 
+// Values go right after the key of their node, or after the header of a block of their own, and neither is
+// aligned for them, so they are always copied in and out instead of being read in place.
+template<typename ValueT>
+inline ValueT read_value(const char* base, int offset) {
+	ValueT val;
+	std::memcpy(&val, base + offset, sizeof(ValueT));
+	return val;
+}
+
+template<typename ValueT>
+inline void write_value(char* base, int offset, ValueT val) {
+	std::memcpy(base + offset, &val, sizeof(ValueT));
+}
+
+// Reads a field of a buffer that another thread may be writing to, once, so the value that was checked is
+// the one that is used, and the compiler can't read it again in between.
+template<typename T>
+inline T load_once(const T& field) {
+	return *(const volatile T*)&field;
+}
+
+template<typename OffsetT>
 struct MatchResult {
 	bool success;
-	node_header_info* current;
+	node_header_info<OffsetT>* current;
 	short position_in_current_node;
 };
+
+template<typename OffsetT>
+inline OffsetT block_size_for(int payload_size) {
+	const int granularity = sizeof(block_header_info<OffsetT>);
+	return (OffsetT)((granularity + payload_size + granularity - 1) & ~(granularity - 1));
+}
+
+// free blocks of up to 16 bytes, up to 32 bytes, and so on, the last list has everything above 1024 bytes
+inline int free_list_index(int block_size) {
+	int index = 0;
+	while (index < FREE_LISTS_COUNT - 1 && block_size > (16 << index))
+		index++;
+	return index;
+}
+
+template<typename OffsetT>
+inline free_block_info<OffsetT>* get_free_links(block_header_info<OffsetT>* block) {
+	return (free_block_info<OffsetT>*)(block + 1);
+}
+
+template<typename OffsetT>
+inline block_header_info<OffsetT>* get_block(char* base, non_deduced_t<OffsetT> offset) {
+	return (block_header_info<OffsetT>*)(base + offset - sizeof(block_header_info<OffsetT>));
+}
+
+template<typename OffsetT>
+inline OffsetT block_size(block_header_info<OffsetT>* block) {
+	return (OffsetT)(block->size_and_kind & ~3);
+}
+
+template<typename OffsetT>
+inline unsigned char block_kind(block_header_info<OffsetT>* block) {
+	return (unsigned char)(block->size_and_kind & 3);
+}
+
+// whether offset points inside the block at block_offset, like the value of a node that was allocated with it
+template<typename OffsetT>
+inline bool inside_block(char* base, non_deduced_t<OffsetT> block_offset, non_deduced_t<OffsetT> offset) {
+	return offset >= block_offset &&
+		offset < block_offset - (OffsetT)sizeof(block_header_info<OffsetT>) + block_size(get_block<OffsetT>(base, block_offset));
+}
+
+template<typename OffsetT>
+inline OffsetT offset_of(char* base, void* field) {
+	return (OffsetT)((char*)field - base);
+}
+
+template<typename OffsetT>
+inline node_header_info<OffsetT>* get_root(char* base) {
+	return (node_header_info<OffsetT>*)(base + ((trie_header_info<OffsetT>*)base)->root_offset);
+}
+
+// placeholders in routes are stored as these bytes, which don't show up in url paths
+const char ROUTE_PARAMETER = '\x01';
+const char ROUTE_CATCH_ALL = '\x02';
+
+// every node below the root consumes at least one byte of a stored key, so no path is deeper than this
+const int MAX_TRIE_DEPTH = UINT8_MAX + 2;
+
+enum children_kind : unsigned char {
+	node4,
+	node16,
+	node48,
+	node256
+};
+
+template<typename OffsetT>
+struct children_header_info
+{
+	unsigned char kind;
+	unsigned char reserved;
+	short count;
+};
+
+// children array layouts, after the children_header_info:
+//  node4 / node16: [first byte of each child, sorted][offset of each child]
+//  node48: [slot + 1 of the child for each possible first byte, 0 if none][offset of each child]
+//  node256: [offset of the child for each possible first byte, 0 if none]
+inline int children_capacity(unsigned char kind) {
+	switch (kind) {
+	case node4: return 4;
+	case node16: return 16;
+	case node48: return 48;
+	default: return 256;
+	}
+}
+
+template<typename OffsetT>
+inline OffsetT children_size(unsigned char kind) {
+	switch (kind) {
+	case node4: return sizeof(children_header_info<OffsetT>) + 4 * (sizeof(unsigned char) + sizeof(OffsetT));
+	case node16: return sizeof(children_header_info<OffsetT>) + 16 * (sizeof(unsigned char) + sizeof(OffsetT));
+	case node48: return sizeof(children_header_info<OffsetT>) + 256 * sizeof(unsigned char) + 48 * sizeof(OffsetT);
+	default: return sizeof(children_header_info<OffsetT>) + 256 * sizeof(OffsetT);
+	}
+}
+
+inline unsigned char tightest_children_kind(int number_of_children) {
+	if (number_of_children <= 4)
+		return node4;
+	if (number_of_children <= 16)
+		return node16;
+	if (number_of_children <= 48)
+		return node48;
+	return node256;
+}
+
+// we only shrink once we are well below the capacity of the smaller kind, so a single
+// remove / write pair on the boundary doesn't keep reallocating the children
+inline unsigned char shrunk_children_kind(unsigned char kind, int number_of_children) {
+	switch (kind) {
+	case node16: return number_of_children <= 3 ? (unsigned char)node4 : kind;
+	case node48: return number_of_children <= 12 ? (unsigned char)node16 : kind;
+	case node256: return number_of_children <= 40 ? (unsigned char)node48 : kind;
+	default: return kind;
+	}
+}
+
+template<typename OffsetT>
+inline children_header_info<OffsetT>* get_children(char* base, non_deduced_t<OffsetT> children_offset) {
+	return (children_header_info<OffsetT>*)(base + children_offset);
+}
+
+template<typename OffsetT>
+inline unsigned char* sorted_first_bytes(children_header_info<OffsetT>* children) {
+	return (unsigned char*)(children + 1);
+}
+
+template<typename OffsetT>
+inline OffsetT* sorted_offsets(children_header_info<OffsetT>* children) {
+	return (OffsetT*)(sorted_first_bytes(children) + children_capacity(children->kind));
+}
+
+template<typename OffsetT>
+inline unsigned char* indexed_slots(children_header_info<OffsetT>* children) {
+	return (unsigned char*)(children + 1);
+}
+
+template<typename OffsetT>
+inline OffsetT* indexed_offsets(children_header_info<OffsetT>* children) {
+	return (OffsetT*)(indexed_slots(children) + 256);
+}
+
+template<typename OffsetT>
+inline OffsetT* direct_offsets(children_header_info<OffsetT>* children) {
+	return (OffsetT*)(children + 1);
+}
+
+template<typename OffsetT>
+inline void init_children(children_header_info<OffsetT>* children, unsigned char kind) {
+	std::memset(children, 0, children_size<OffsetT>(kind));
+	children->kind = kind;
+}
+
+// the caller is responsible for making sure that there is room for the new child
+template<typename OffsetT>
+inline void add_child(children_header_info<OffsetT>* children, unsigned char first_byte, OffsetT child_offset) {
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		auto first_bytes = sorted_first_bytes(children);
+		auto offsets = sorted_offsets(children);
+		int insert_at = children->count;
+		while (insert_at > 0 && first_bytes[insert_at - 1] > first_byte)
+			insert_at--;
+		std::memmove(first_bytes + insert_at + 1, first_bytes + insert_at, children->count - insert_at);
+		std::memmove(offsets + insert_at + 1, offsets + insert_at, sizeof(OffsetT) * (children->count - insert_at));
+		first_bytes[insert_at] = first_byte;
+		offsets[insert_at] = child_offset;
+		break;
+	}
+	case node48: {
+		auto offsets = indexed_offsets(children);
+		int slot = 0;
+		while (offsets[slot] != 0)
+			slot++;
+		offsets[slot] = child_offset;
+		indexed_slots(children)[first_byte] = (unsigned char)(slot + 1);
+		break;
+	}
+	default:
+		direct_offsets(children)[first_byte] = child_offset;
+		break;
+	}
+	children->count++;
+}
+
+template<typename OffsetT>
+inline void remove_child(children_header_info<OffsetT>* children, unsigned char first_byte) {
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		auto first_bytes = sorted_first_bytes(children);
+		auto offsets = sorted_offsets(children);
+		int index = 0;
+		while (index < children->count && first_bytes[index] != first_byte)
+			index++;
+		if (index == children->count)
+			return;
+		std::memmove(first_bytes + index, first_bytes + index + 1, children->count - index - 1);
+		std::memmove(offsets + index, offsets + index + 1, sizeof(OffsetT) * (children->count - index - 1));
+		break;
+	}
+	case node48: {
+		auto slot = indexed_slots(children)[first_byte];
+		if (slot == 0)
+			return;
+		indexed_offsets(children)[slot - 1] = 0;
+		indexed_slots(children)[first_byte] = 0;
+		break;
+	}
+	default:
+		if (direct_offsets(children)[first_byte] == 0)
+			return;
+		direct_offsets(children)[first_byte] = 0;
+		break;
+	}
+	children->count--;
+}
+
+// the slot that holds the child for first_byte, or nullptr if there is no such child
+template<typename OffsetT>
+inline OffsetT* child_slot(children_header_info<OffsetT>* children, unsigned char first_byte) {
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		auto first_bytes = sorted_first_bytes(children);
+		for (int i = 0; i < children->count; i++) {
+			if (first_bytes[i] == first_byte)
+				return sorted_offsets(children) + i;
+		}
+		return nullptr;
+	}
+	case node48: {
+		auto slot = indexed_slots(children)[first_byte];
+		return slot == 0 ? nullptr : indexed_offsets(children) + slot - 1;
+	}
+	default:
+		return direct_offsets(children)[first_byte] == 0 ? nullptr : direct_offsets(children) + first_byte;
+	}
+}
+
+// the offset of the first child whose first byte is not less than from, or 0 if there is none
+template<typename OffsetT>
+inline OffsetT next_child(children_header_info<OffsetT>* children, int from, unsigned char& first_byte) {
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		auto first_bytes = sorted_first_bytes(children);
+		for (int i = 0; i < children->count; i++) {
+			if (first_bytes[i] >= from) {
+				first_byte = first_bytes[i];
+				return sorted_offsets(children)[i];
+			}
+		}
+		return 0;
+	}
+	case node48: {
+		auto slots = indexed_slots(children);
+		for (int i = from; i < 256; i++) {
+			if (slots[i] != 0) {
+				first_byte = (unsigned char)i;
+				return indexed_offsets(children)[slots[i] - 1];
+			}
+		}
+		return 0;
+	}
+	default: {
+		auto offsets = direct_offsets(children);
+		for (int i = from; i < 256; i++) {
+			if (offsets[i] != 0) {
+				first_byte = (unsigned char)i;
+				return offsets[i];
+			}
+		}
+		return 0;
+	}
+	}
+}
+
+// calls action(first_byte, child_offset) for each child, in ascending first byte order
+template<typename OffsetT, typename Action>
+void for_each_child(children_header_info<OffsetT>* children, Action action) {
+	switch (children->kind) {
+	case node4:
+	case node16: {
+		auto first_bytes = sorted_first_bytes(children);
+		auto offsets = sorted_offsets(children);
+		for (int i = 0; i < children->count; i++)
+			action(first_bytes[i], offsets[i]);
+		break;
+	}
+	case node48: {
+		auto slots = indexed_slots(children);
+		auto offsets = indexed_offsets(children);
+		for (int i = 0; i < 256; i++) {
+			if (slots[i] != 0)
+				action((unsigned char)i, offsets[slots[i] - 1]);
+		}
+		break;
+	}
+	default: {
+		auto offsets = direct_offsets(children);
+		for (int i = 0; i < 256; i++) {
+			if (offsets[i] != 0)
+				action((unsigned char)i, offsets[i]);
+		}
+		break;
+	}
+	}
+}
+
+// points the block of each child back at the slot that holds it, needed whenever the slots move
+template<typename OffsetT>
+inline void update_children_owners(char* base, children_header_info<OffsetT>* children) {
+	for_each_child(children, [base](unsigned char, OffsetT& offset) {
+		get_block<OffsetT>(base, offset)->owner = offset_of<OffsetT>(base, &offset);
+	});
+}
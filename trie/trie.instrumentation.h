@@ -0,0 +1,161 @@
+#pragma once
+
+#include "trie.intrinsics.h"
+
+// Latencies in nanoseconds, in log-linear buckets like HdrHistogram's: every power of two is split into
+// SUB_BUCKETS buckets of the same width, so each latency is recorded within an eighth of its value, from
+// a nanosecond up to the full 64 bits, with a fixed number of buckets and no allocations.
+struct trie_latency_histogram {
+	static const int SUB_BUCKET_BITS = 3;
+	static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	uint64_t counts[BUCKETS] = {};
+	uint64_t count = 0;
+	uint64_t max = 0;
+
+	static int bucket_of(uint64_t nanoseconds) {
+		if (nanoseconds < SUB_BUCKETS)
+			return (int)nanoseconds;
+		auto shift = highest_set_bit(nanoseconds) - SUB_BUCKET_BITS;
+		return (shift + 1) * SUB_BUCKETS + (int)((nanoseconds >> shift) - SUB_BUCKETS);
+	}
+
+	// the largest latency that goes to the bucket
+	static uint64_t bucket_upper_bound(int bucket) {
+		if (bucket < SUB_BUCKETS)
+			return (uint64_t)bucket;
+		auto shift = bucket / SUB_BUCKETS - 1;
+		return ((uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS + 1) << shift) - 1;
+	}
+
+	void record(uint64_t nanoseconds) {
+		counts[bucket_of(nanoseconds)]++;
+		count++;
+		max = std::max(max, nanoseconds);
+	}
+
+	// The latency that the given fraction of the recorded ones, between 0 and 1, don't go over. It is the upper
+	// bound of the bucket it falls in, so it may be a little higher than any latency that was recorded.
+	uint64_t percentile(double fraction) const {
+		auto rank = (uint64_t)(fraction * count + 0.5);
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; i++) {
+			seen += counts[i];
+			if (seen >= rank && seen > 0)
+				return std::min(bucket_upper_bound(i), max);
+		}
+		return 0;
+	}
+
+	void merge(const trie_latency_histogram& other) {
+		for (int i = 0; i < BUCKETS; i++)
+			counts[i] += other.counts[i];
+		count += other.count;
+		max = std::max(max, other.max);
+	}
+};
+
+// What an instrumented trie has counted since it was created or its stats were reset.
+struct trie_operation_stats {
+	uint64_t lookups = 0; // try_read calls
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t nodes_visited = 0; // by all the lookups, divided by lookups it is the average depth of one
+	uint64_t max_nodes_visited = 0;
+
+	uint64_t node_splits = 0; // a write that ends in the middle of a node's key fragment splits the node
+	uint64_t children_reallocations = 0; // a children array that is full moves to one of the next kind
+	uint64_t out_of_space = 0; // the checks for room that failed, some of them are then fixed by a defrag
+	uint64_t implicit_defrags = 0; // the ones a write ran because it had no room
+	uint64_t compaction_steps = 0; // the ones a write ran because of set_compaction_policy
+	uint64_t bytes_reclaimed = 0; // by both
+
+	trie_latency_histogram read_latency;
+	trie_latency_histogram write_latency;
+	trie_latency_histogram remove_latency;
+};
+
+enum class trie_operation {
+	read,
+	write,
+	remove
+};
+
+// The instrumentation policy of basic_trie, which the trie derives from and calls at each of the points below.
+// This one does nothing, and takes no room, so a trie that uses it compiles to exactly the same code as
+// one with no instrumentation at all. A policy can derive from it and hide only the calls it cares about.
+struct trie_no_instrumentation {
+	// whether the trie does the extra work that only the calls need, like counting the nodes a lookup visits
+	static const bool enabled = false;
+
+	struct timing {
+	};
+
+	timing start_timing() const { return timing(); }
+
+	void on_finished(trie_operation, timing) const {}
+
+	void on_lookup(bool, int) const {}
+
+	void on_node_split() const {}
+
+	void on_children_reallocated() const {}
+
+	void on_out_of_space() const {}
+
+	void on_defrag(int) const {}
+
+	void on_compaction_step(int) const {}
+};
+
+// Counts into a trie_operation_stats, and times try_read, write and remove. The stats are updated without
+// any synchronization, even by the const reads, so an instrumented trie can't be read from many threads
+// at once. The stats are in this base class, which comes before the buffer of the trie, so the buffer isn't
+// at the start of an instrumented trie, and it can't be a view of serialized data or live in a mapped file.
+struct trie_instrumentation : trie_no_instrumentation {
+	static const bool enabled = true;
+
+	using timing = std::chrono::steady_clock::time_point;
+
+	const trie_operation_stats& stats() const { return _stats; }
+
+	void reset_stats() { _stats = trie_operation_stats(); }
+
+	timing start_timing() const { return std::chrono::steady_clock::now(); }
+
+	void on_finished(trie_operation operation, timing start) const {
+		auto elapsed = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		switch (operation) {
+		case trie_operation::read: _stats.read_latency.record(elapsed); break;
+		case trie_operation::write: _stats.write_latency.record(elapsed); break;
+		case trie_operation::remove: _stats.remove_latency.record(elapsed); break;
+		}
+	}
+
+	void on_lookup(bool found, int nodes_visited) const {
+		_stats.lookups++;
+		(found ? _stats.hits : _stats.misses)++;
+		_stats.nodes_visited += nodes_visited;
+		_stats.max_nodes_visited = std::max(_stats.max_nodes_visited, (uint64_t)nodes_visited);
+	}
+
+	void on_node_split() const { _stats.node_splits++; }
+
+	void on_children_reallocated() const { _stats.children_reallocations++; }
+
+	void on_out_of_space() const { _stats.out_of_space++; }
+
+	void on_defrag(int bytes_reclaimed) const {
+		_stats.implicit_defrags++;
+		_stats.bytes_reclaimed += bytes_reclaimed;
+	}
+
+	void on_compaction_step(int bytes_reclaimed) const {
+		_stats.compaction_steps++;
+		_stats.bytes_reclaimed += bytes_reclaimed;
+	}
+
+private:
+	mutable trie_operation_stats _stats;
+};
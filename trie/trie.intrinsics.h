@@ -0,0 +1,215 @@
+#pragma once
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRIE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// the CRC32C instructions come with SSE4.2, which is checked for at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#define TRIE_CRC32C_INSTRUCTIONS 1
+#endif
+
+// tells the CPU that this is a spin wait, which saves power and lets a hyper-thread sibling run
+inline void cpu_pause() {
+#if defined(TRIE_SSE2) || defined(TRIE_AVX2)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TRIE_BIG_ENDIAN 1
+#endif
+
+inline int count_trailing_zeros(unsigned int mask) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// index of the first byte (in memory order) that is not zero, x must not be zero
+inline int first_non_zero_byte(uint64_t x) {
+#if TRIE_BIG_ENDIAN
+	return __builtin_clzll(x) / 8;
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index / 8;
+#elif defined(_MSC_VER)
+	if ((unsigned int)x != 0)
+		return count_trailing_zeros((unsigned int)x) / 8;
+	return 4 + count_trailing_zeros((unsigned int)(x >> 32)) / 8;
+#else
+	return __builtin_ctzll(x) / 8;
+#endif
+}
+
+// index of the highest bit that is set, x must not be zero
+inline int highest_set_bit(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(x >> 32)))
+		return (int)index + 32;
+	_BitScanReverse(&index, (unsigned long)x);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(x);
+#endif
+}
+
+// Returns the number of leading bytes that x and y have in common, looking at no more than size bytes.
+// Compares a word at a time, and never reads past size on either side.
+inline int common_prefix_length(const char* x, const char* y, int size) {
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t a, b;
+		std::memcpy(&a, x + i, sizeof(a));
+		std::memcpy(&b, y + i, sizeof(b));
+		if (a != b)
+			return i + first_non_zero_byte(a ^ b);
+	}
+	if (i < size) {
+		uint64_t a = 0, b = 0;
+		std::memcpy(&a, x + i, size - i);
+		std::memcpy(&b, y + i, size - i);
+		if (a != b)
+			return i + first_non_zero_byte(a ^ b);
+	}
+	return size;
+}
+
+// Returns the index of the first byte in bytes[0, count) that is equal to value, or -1.
+// The vector paths load whole blocks, so this may read past count, but never past readable.
+inline int find_byte(const unsigned char* bytes, int count, int readable, unsigned char value) {
+	int i = 0;
+#if TRIE_AVX2
+	auto needle = _mm256_set1_epi8((char)value);
+	for (; i < count && i + 32 <= readable; i += 32) {
+		auto block = _mm256_loadu_si256((const __m256i*)(bytes + i));
+		auto mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+		if (count - i < 32)
+			mask &= (1u << (count - i)) - 1;
+		if (mask != 0)
+			return i + count_trailing_zeros(mask);
+	}
+#elif TRIE_SSE2
+	auto needle = _mm_set1_epi8((char)value);
+	for (; i < count && i + 16 <= readable; i += 16) {
+		auto block = _mm_loadu_si128((const __m128i*)(bytes + i));
+		auto mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+		if (count - i < 16)
+			mask &= (1u << (count - i)) - 1;
+		if (mask != 0)
+			return i + count_trailing_zeros(mask);
+	}
+#endif
+	for (; i < count; i++) {
+		if (bytes[i] == value)
+			return i;
+	}
+	return -1;
+}
+
+// reverses the order of the bytes of an integer, compilers turn this into a single instruction
+template<typename T>
+inline T byte_swap(T value) {
+	T swapped;
+	auto from = (const unsigned char*)&value;
+	auto to = (unsigned char*)&swapped;
+	for (size_t i = 0; i < sizeof(T); i++)
+		to[i] = from[sizeof(T) - 1 - i];
+	return swapped;
+}
+
+// converts between the host byte order and little endian, which is the byte order of serialized tries
+template<typename T>
+inline T little_endian(T value) {
+#if TRIE_BIG_ENDIAN
+	return byte_swap(value);
+#else
+	return value;
+#endif
+}
+
+// CRC32C (Castagnoli), a byte at a time from a table. Pass the result of a previous call as crc to continue it.
+inline uint32_t crc32c_table(uint32_t crc, const char* data, size_t size) {
+	struct table {
+		uint32_t entries[256];
+		table() {
+			for (uint32_t i = 0; i < 256; i++) {
+				auto entry = i;
+				for (int bit = 0; bit < 8; bit++)
+					entry = entry & 1 ? (entry >> 1) ^ 0x82F63B78 : entry >> 1;
+				entries[i] = entry;
+			}
+		}
+	};
+	static const table crc_table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = crc_table.entries[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#if TRIE_CRC32C_INSTRUCTIONS
+
+#if defined(_MSC_VER)
+#define TRIE_TARGET_SSE42
+
+inline bool has_sse42() {
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+}
+#else
+#define TRIE_TARGET_SSE42 __attribute__((target("sse4.2")))
+
+inline bool has_sse42() {
+	return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+// the same as crc32c_table, 8 bytes per instruction, only for CPUs that have SSE4.2
+TRIE_TARGET_SSE42 inline uint32_t crc32c_sse42(uint32_t crc, const char* data, size_t size) {
+	uint64_t crc64 = ~crc;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	auto crc32 = (uint32_t)crc64;
+	for (; i < size; i++)
+		crc32 = _mm_crc32_u8(crc32, (unsigned char)data[i]);
+	return ~crc32;
+}
+
+#endif
+
+inline uint32_t crc32c(uint32_t crc, const char* data, size_t size) {
+#if TRIE_CRC32C_INSTRUCTIONS
+	static const bool sse42 = has_sse42();
+	if (sse42)
+		return crc32c_sse42(crc, data, size);
+#endif
+	return crc32c_table(crc, data, size);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "trie.h"
+#include "trie.intrinsics.h"
+
+// Publishes immutable versions of a trie. Readers open a view of the current version and read it with no
+// synchronization at all, it won't change or go away while they hold it. A writer changes a private copy
+// of the current version, see update, and then swaps it in with a single atomic store.
+// Replaced versions are retired with epoch based reclamation: every view records the epoch it started in,
+// in one of the reader slots, and a version retired in some epoch is only deleted once no view that started
+// in that epoch or before it is still open. The writer does that after each update, readers never wait on it.
+template<typename Trie>
+class trie_handle {
+public:
+	using trie_type = Trie;
+
+	// A consistent point in time view of the trie, for as long as it is open. Views are meant to be short
+	// lived, while one is open the versions retired after it was opened can't be deleted.
+	class view {
+	public:
+		view(view&& other) noexcept : _slot(other._slot), _trie(other._trie) {
+			other._slot = nullptr;
+		}
+
+		view(const view&) = delete;
+
+		view& operator=(const view&) = delete;
+
+		~view() {
+			if (_slot != nullptr)
+				_slot->store(0, std::memory_order_release);
+		}
+
+		const Trie& operator*() const {
+			return *_trie;
+		}
+
+		const Trie* operator->() const {
+			return _trie;
+		}
+	private:
+		friend class trie_handle;
+
+		view(std::atomic<uint64_t>* slot, const Trie* trie) : _slot(slot), _trie(trie) {
+		}
+
+		std::atomic<uint64_t>* _slot;
+		const Trie* _trie;
+	};
+
+	trie_handle() : _current(new Trie()), _epoch(1) {
+	}
+
+	explicit trie_handle(std::unique_ptr<Trie> initial) : _current(initial.release()), _epoch(1) {
+	}
+
+	trie_handle(const trie_handle&) = delete;
+
+	trie_handle& operator=(const trie_handle&) = delete;
+
+	// no view may outlive the handle
+	~trie_handle() {
+		delete _current.load();
+		for (auto& version : _retired)
+			delete version.trie;
+	}
+
+	view snapshot() const {
+		auto& slot = claim_slot();
+		return view(&slot, _current.load(std::memory_order_seq_cst));
+	}
+
+	// Runs action(trie) on a copy of the current version, and publishes the copy once it returns. Readers see
+	// all of the changes or none of them. Writers take turns, the copy is made once for the whole action, so
+	// it pays to batch many writes in a single update.
+	template<typename Action>
+	auto update(Action action) {
+		std::lock_guard<std::mutex> lock(_writer);
+		auto next = _current.load(std::memory_order_relaxed)->snapshot();
+
+		struct publish_on_exit {
+			trie_handle& handle;
+			std::unique_ptr<Trie>& next;
+			~publish_on_exit() {
+				handle.publish(std::move(next));
+			}
+		} publish{ *this, next };
+
+		return action(*next);
+	}
+
+	trie_base::result write(std::string_view key, typename Trie::mapped_type val) {
+		return update([&](Trie& trie) { return trie.write(key, val); });
+	}
+
+	bool remove(std::string_view key) {
+		return update([&](Trie& trie) { return trie.remove(key); });
+	}
+
+	// the number of replaced versions that are still waiting for their readers to leave
+	size_t retired_count() const {
+		std::lock_guard<std::mutex> lock(_writer);
+		return _retired.size();
+	}
+
+private:
+	// more views than this open at once wait for one of them to close
+	static const int READER_SLOTS = 64;
+
+	struct alignas(64) reader_slot {
+		std::atomic<uint64_t> epoch{ 0 }; // 0 when no view holds the slot
+	};
+
+	struct retired_version {
+		Trie* trie;
+		uint64_t epoch;
+	};
+
+	// The slot is taken before the current version is loaded, so a writer that doesn't see it yet when it
+	// looks for readers has already published the next version, and this view gets that one.
+	std::atomic<uint64_t>& claim_slot() const {
+		static thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+		for (size_t i = hint;; i++) {
+			auto& slot = _slots[i % READER_SLOTS].epoch;
+			uint64_t idle = 0;
+			if (slot.load(std::memory_order_relaxed) == 0 &&
+				slot.compare_exchange_strong(idle, _epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst)) {
+				hint = i % READER_SLOTS;
+				return slot;
+			}
+			if ((i + 1) % READER_SLOTS == hint % READER_SLOTS)
+				cpu_pause(); // every slot is taken
+		}
+	}
+
+	void publish(std::unique_ptr<Trie> next) {
+		auto old = _current.exchange(next.release(), std::memory_order_seq_cst);
+		_retired.push_back(retired_version{ old, _epoch.fetch_add(1, std::memory_order_seq_cst) });
+		reclaim();
+	}
+
+	// a view that started after the epoch a version was retired in can't be reading it
+	void reclaim() {
+		auto oldest = std::numeric_limits<uint64_t>::max();
+		for (auto& slot : _slots) {
+			auto epoch = slot.epoch.load(std::memory_order_seq_cst);
+			if (epoch != 0)
+				oldest = std::min(oldest, epoch);
+		}
+
+		auto still_read = std::remove_if(_retired.begin(), _retired.end(), [oldest](const retired_version& version) {
+			if (version.epoch >= oldest)
+				return false;
+			delete version.trie;
+			return true;
+		});
+		_retired.erase(still_read, _retired.end());
+	}
+
+	std::atomic<Trie*> _current;
+	alignas(64) std::atomic<uint64_t> _epoch;
+	mutable reader_slot _slots[READER_SLOTS];
+	mutable std::mutex _writer;
+	std::vector<retired_version> _retired;
+};